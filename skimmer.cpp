@@ -0,0 +1,5168 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <set>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cfloat>
+#include <deque>
+
+//Boost includes
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/asio.hpp>
+
+//ROOT includes
+#include <TROOT.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TChain.h>
+#include <TTree.h>
+#include <TTreeFormula.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TBranchElement.h>
+#include <TBasket.h>
+#include <TBuffer.h>
+#include <TRegexp.h>
+#include <TString.h>
+#include <TStopwatch.h>
+#include <TTreePerfStats.h>
+#include <TTreeCache.h>
+#include <TTimeStamp.h>
+#include <TSystem.h>
+#include <TMD5.h>
+#include <TH1D.h>
+#include <TFileMerger.h>
+#include <TEnv.h>
+#include <TEntryList.h>
+#include <TKey.h>
+#include <RVersion.h>
+
+//RNTuple is read and written through RDataFrame, which
+//can snapshot to RNTuple from ROOT 6.34
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 34, 0)
+#define SKIMSLIM_WITH_RNTUPLE
+#include <ROOT/RDataFrame.hxx>
+#endif
+
+//PhysicsTools includes
+#include "skimmer.h"
+#include "skimmer_internal.h"
+#include "skimmer_compiled.h"
+#include "skimmer_index.h"
+#include "skimmer_columnar.h"
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespaces
+using namespace boost;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//The skim interface
+using namespace PhysicsTools;
+
+//The internals shared between the skimmer's sources
+using namespace PhysicsTools::Internal;
+
+//Everything else is internal to the skimmer
+namespace
+{
+
+//Cache size used when branches are registered with the
+//TTreeCache but no size is given
+const Long64_t DEFAULT_CACHE_SIZE = 30000000;
+
+//Basket memory budget used by TTree::OptimizeBaskets
+//(this is ROOT's own default)
+const Long64_t DEFAULT_OPTIMIZE_BASKETS_MEMORY = 10000000;
+
+//Progress is only checked when the entry count is a
+//multiple of this mask plus one
+const Long64_t PROGRESS_CHECK_MASK = 0xFFF;
+
+//Memory is only checked when the entry count is a
+//multiple of this mask plus one
+const Long64_t MEMORY_CHECK_MASK = 0xFFF;
+
+//Shares of --max-memory given to the input TTreeCache and
+//to the output baskets (of all streams together).  The
+//rest is left for formulas, open files and dictionaries.
+const double MEMORY_CACHE_FRACTION = 0.25;
+const double MEMORY_OUTPUT_FRACTION = 0.25;
+
+//Smallest basket size used when shrinking the output
+//baskets to fit the memory ceiling
+const int MINIMUM_BOUNDED_BASKET_SIZE = 4096;
+
+//Default seconds between progress reports
+const double DEFAULT_PROGRESS_INTERVAL = 10;
+
+//Number of evaluations between reorderings of the cuts
+//of a staged selection
+const Long64_t STAGE_REORDER_INTERVAL = 100000;
+
+//When reordering, one in every this mask plus one
+//evaluations of a staged selection is timed
+const Long64_t STAGE_TIMING_MASK = 0xF;
+
+//The selection expression used when no cuts are applied
+const string TRIVIAL_SELECTION = "1";
+
+//Default number of entries in each batch (and Parquet
+//row group) of a columnar output
+const Long64_t DEFAULT_ROW_GROUP_SIZE = 65536;
+
+//Names of the entry list and index tree written instead
+//of the selected data with --entry-list-output
+const string ENTRY_LIST_NAME = "selected";
+const string ENTRY_INDEX_TREE_NAME = "selected_index";
+
+}
+
+namespace PhysicsTools
+{
+
+po::options_description get_skim_options()
+{
+	//Create the options specifier.  (This code is correct, it's
+	//Boost voodoo using Boost.Assign.)
+	po::options_description desc("Allowed Options");
+	desc.add_options()
+		("verbose,v", "Make the program print more detailed output to command line.")
+		("input,i", po::value<string>(), "The path (either a file or directory) to the input data.")
+		("input-list,I", po::value<string>(), "A file listing the input files (paths or URLs), one per line, instead of"
+											  " --input.  Each path may be followed by the number of entries in the file,"
+											  " so that it needn't be opened to count them, and by the range of any"
+											  " branches in the file as BRANCH=MIN:MAX.  Files whose ranges show that"
+											  " no entry can pass a cut of the form BRANCH OP VALUE are skipped.")
+		("container,c", po::value<string>(), "The name of the TTree container in the input file.")
+		("selection,s", po::value< vector<string> >()->multitoken(), "A selection expression to apply to the tree.")
+		("define", po::value< vector<string> >()->multitoken(), "Add a branch to the output computed for each selected entry,"
+																" given as NAME=EXPRESSION.  NAME can be used in the selection"
+																" (where it is computed once per entry, and the value"
+																" reused for the output) and in later definitions.  With"
+																" --compile-selection, definitions are compiled too.")
+		("object-selection", po::value< vector<string> >()->multitoken(), "Keep only the elements of a collection passing a selection,"
+																		  " given as PREFIX:EXPRESSION or PREFIX:COUNT:EXPRESSION."
+																		  "  EXPRESSION is evaluated for each element, and every"
+																		  " vector branch whose name starts with PREFIX is filtered"
+																		  " to the elements passing it (e.g. jet_:jet_n:jet_pt>20)."
+																		  "  The integer branch COUNT, if given, is updated to the"
+																		  " number kept.  Other scalar branches with PREFIX are"
+																		  " left as they are, and any other branch with PREFIX is"
+																		  " an error.")
+		("selection-file,S", po::value< vector<string> >()->multitoken(), "A file containing a selection expression to apply to the tree."
+																			"  The file can contain multiple lines, each of which represents"
+																			" a selection expression to apply.  Comments can be included if"
+																			" you begin the line with #.")
+		("enable-branches,e", po::value< vector<string> >()->multitoken(), "Enable a branch (overrides branch disabling).")
+		("disable-branches,d", po::value< vector<string> >()->multitoken(), "Disable a branch.")
+		("disable-all-branches,D", "Disable all branches.")
+		("cache-size", po::value<Long64_t>(), "Size in bytes of the TTreeCache used for reading the input.  The cache"
+											  " is primed with exactly the branches that will be read, so the learning"
+											  " phase is skipped.")
+		("cache-branches", po::value< vector<string> >()->multitoken(), "Additional branch(es) to register with the TTreeCache"
+																		" (enables the cache with a default size if"
+																		" --cache-size is not given).")
+		("prefetch", "Read ahead in the background: the TTreeCache (enabled with a default size"
+					 " if --cache-size is not given) is filled asynchronously, and the next file"
+					 " of the chain is opened while the current one is being processed.")
+		("prefetch-cache-dir", po::value<string>(), "Keep a local copy of the blocks read with --prefetch in this"
+													" directory, and read them from there on later runs.")
+		("compression,z", po::value<string>(), "Compression for the output file, given as ALGORITHM[:LEVEL] where"
+											   " ALGORITHM is one of ZLIB, LZMA, LZ4 or ZSTD, or as a numeric"
+											   " ROOT compression setting (e.g. 404).")
+		("branch-compression", po::value< vector<string> >()->multitoken(), "Override the compression for output branch(es), given"
+																			" as BRANCH=ALGORITHM[:LEVEL].  BRANCH may contain"
+																			" wildcards.")
+		("output-threads", po::value<int>()->implicit_value(0), "Compress output baskets in parallel on ROOT's implicit"
+																" multi-threading pool of this many threads (or as many"
+																" as there are cores if no number is given).  Baskets"
+																" are compressed as they are flushed, so this works"
+																" best with --auto-flush.")
+		("basket-size", po::value<int>(), "Basket size in bytes for all output branches.")
+		("auto-flush", po::value<Long64_t>(), "Auto-flush setting for the output tree.  A positive value flushes"
+											  " the baskets every N entries, a negative value every -N bytes.")
+		("optimize-baskets", po::value<int>(), "Resize the output baskets with TTree::OptimizeBaskets after this many"
+											   " output entries have been written.")
+		("optimize-baskets-memory", po::value<Long64_t>()->default_value(DEFAULT_OPTIMIZE_BASKETS_MEMORY),
+									"Total basket memory in bytes to distribute when optimizing baskets.")
+		("max-memory", po::value<Long64_t>(), "Keep the resident memory below this many bytes.  The TTreeCache and the"
+											  " output baskets are each limited to a quarter of it (the baskets are"
+											  " shrunk and flushed early as needed), peak memory is reported for each,"
+											  " and the skim stops with an error if the ceiling is still exceeded.")
+		("no-fast-clone", "Don't use fast cloning (raw basket copying) when no selection is applied.")
+		("stats", "Print a report of throughput, I/O and time spent in each part of the entry loop.")
+		("stats-json", po::value<string>(), "Write the statistics report to this path as JSON.")
+		("progress,p", po::value<double>()->implicit_value(DEFAULT_PROGRESS_INTERVAL),
+					   "Print progress (entries, selected fraction, read rate and ETA) to standard"
+					   " error at most this many seconds apart.")
+		("short-circuit", "Evaluate each selection expression (or selection file line) separately,"
+						  " in order, stopping at the first which fails.  Branches used only by"
+						  " later cuts are then not read for entries failing earlier ones.")
+		("reorder-cuts", "Short-circuit the cuts, and periodically reorder them by their measured"
+						 " cost per rejected entry, so that cheap, highly rejecting cuts run first.")
+		("cutflow", "Record the number of entries passing each cut, in order, and write them to"
+					" each output file as a histogram (cutflow) and to OUTPUT.cutflow.txt as text."
+					"  Implies short-circuit evaluation without reordering, and can't be combined with"
+					" --max-output-events, which would stop it counting early.")
+		("cutflow-weight", po::value<string>(), "An expression giving a weight for each entry, whose sums are also recorded"
+												" in the cutflow (as the cutflow_weighted histogram).  Implies --cutflow.")
+		("compile-selection", "Compile the selection to native code with ACLiC instead of interpreting it."
+							  "  Only selections on scalar leaves, using arithmetic, comparison and logical"
+							  " operators and common math functions, can be compiled, others fall back to"
+							  " TTreeFormula.")
+		("compile-cache-dir", po::value<string>()->default_value(string(gSystem->TempDirectory()) + "/skimslim"),
+							  "Directory in which compiled selections are kept, so that they can be reused.")
+		("batch-size", po::value<Long64_t>(), "Evaluate the (compiled) selection over batches of this many entries,"
+											  " copying each leaf into a contiguous column and evaluating the whole"
+											  " batch in one vectorizable call (the leaves are still read entry"
+											  " by entry).  Implies --compile-selection, and"
+											  " is ignored for short-circuited selections.")
+		("cluster-index", po::value<string>(), "A sidecar file holding the minimum and maximum of some branches in each"
+											   " cluster of the input.  Clusters in which no entry can pass a cut of the"
+											   " form BRANCH OP VALUE on an indexed branch are skipped without being"
+											   " read.  The index is built (with a pass over the indexed branches) if it"
+											   " doesn't exist or no longer matches the input (its files' names, entry"
+											   " counts, sizes and modification times).")
+		("index-branches", po::value< vector<string> >()->multitoken(), "The scalar branch(es) to store in the cluster index"
+																		" when building it.")
+		("first-event", po::value<Long64_t>(), "The first input event to process (0 by default).")
+		("max-input-events,m", po::value<int>(), "Maximum number of input events to process (unlimited by default).")
+		("shard", po::value<string>(), "Process only shard K (counting from 0) of N of the input events, given as"
+									   " K/N.  Shards are split at cluster boundaries, so no basket is read by"
+									   " two shards.  Their outputs can be combined with --merge.")
+		("merge", po::value< vector<string> >()->multitoken(), "Instead of skimming, merge these outputs (e.g. of the shards"
+															   " of a skim) into the output file, in order, without"
+															   " recompressing.")
+		("max-output-events,M", po::value<int>(), "Maximum number of output events to write (unlimited by default).")
+		("threads,j", po::value<int>(), "Number of threads to use for evaluating the selection (1 by default)."
+										"  The input is split into contiguous entry ranges, each evaluated"
+										" with its own chain and selection formula.  Selected entries are"
+										" always written in input order, so the output is identical to a"
+										" single-threaded run.")
+		("file-jobs", po::value<int>(), "Skim each input file independently, this many at a time, into temporary"
+										" outputs (OUTPUT.partN.root), then merge them into the output without"
+										" recompressing.  Statistics and progress aren't reported in this mode, and"
+										" it can't be combined with --max-memory or --cluster-index.")
+		("file-retries", po::value<int>()->default_value(1), "Number of times to retry a file which fails to skim"
+															 " when using --file-jobs.")
+		("selection-cache", po::value<string>(), "A directory in which to keep the entries passing each selection, keyed"
+												 " by a hash of the selection and the input files.  A later run with the"
+												 " same selection and input copies the cached entries without evaluating"
+												 " the selection at all.  Implies --two-phase.")
+		("two-phase,2", "Evaluate the selection in a first pass that reads only the branches"
+						" it references, then copy the selected entries in a second pass."
+						"  This is always done when using more than one thread.")
+		("output,o", po::value<string>()->default_value("output.root"), "The output name for the ROOT data file.")
+		("stream", po::value< vector<string> >()->multitoken(), "A file describing an additional output stream, filled in the same"
+																" pass over the input.  The file uses key = value lines with the"
+																" keys output, selection, selection-file, enable-branches,"
+																" disable-branches and disable-all-branches, each meaning the same"
+																" as the command line option.")
+		("entry-list-output", "Instead of copying the selected entries, write a TEntryList (named selected) of"
+							  " them in the input files, and a tree (selected_index) with one row per"
+							  " selected entry giving its chain entry, tree number and entry within that"
+							  " tree, along with any definitions.  Apply the list to the same input with"
+							  " TChain::SetEntryList.  Implies --two-phase.")
+		("columnar-output", po::value<string>(), "Also write the selected entries of the main output to this path as"
+												 " Parquet (if it ends in .parquet) or otherwise as an Arrow IPC file."
+												 "  Enabled leaves and std::vector branches of simple types become"
+												 " columns (arrays as lists), as do definitions.")
+		("row-group-size", po::value<Long64_t>()->default_value(DEFAULT_ROW_GROUP_SIZE),
+						   "Number of entries in each batch (and Parquet row group) of the columnar output.")
+		("output-format", po::value<string>()->default_value("ttree"), "Format of the output container, ttree or rntuple.  RNTuple"
+																	   " input is detected from the first input file.  Either"
+																	   " is processed with RDataFrame, so selections and"
+																	   " definitions must then be C++ expressions, and options"
+																	   " specific to trees aren't available.")
+		("serve", po::value<int>(), "Instead of skimming, serve skim requests on this TCP port.  Each connection"
+									" sends one line of skimslim options (quoted as for the shell) and is"
+									" answered with QUEUED N, RUNNING, then OK or FAILED STATUS; a line of"
+									" QUIT stops the server.  Input chains given by --input are kept open"
+									" between requests, and compiled selections stay loaded.  There is no"
+									" authentication: anyone who can connect can read and write (with"
+									" --replace, overwrite) any file the server's user can, so only serve"
+									" where every user of the host is trusted.  RNTuple input and output,"
+									" whose expressions are compiled as C++, are refused.")
+		("serve-address", po::value<string>()->default_value("127.0.0.1"), "The address the server listens on.  Any"
+																		   " other address exposes the server beyond the"
+																		   " local host.")
+		("serve-jobs", po::value<int>()->default_value(1), "Number of skims the server runs at a time.  With"
+															" more than one, requests may not use --prefetch,"
+															" --output-threads or (with RNTuple) --threads.")
+		("serve-queue", po::value<int>()->default_value(16), "Number of skims which may wait to run before the server"
+															 " answers new requests with BUSY.")
+		("serve-timeout", po::value<int>()->default_value(10), "Seconds the server waits for a connection to send its"
+															   " request before closing it.")
+		("replace,r", "Replace the output file if it already exists.")
+		("help,h", "Print a description of the program options.")
+	;
+
+	return desc;
+}
+
+}
+
+namespace
+{
+
+bool parse_stream_file(string path, bool verbose, po::variables_map &stream_options)
+{
+	//Streams support the subset of the command line options
+	//which describe a selection, a branch set and an output
+	po::options_description desc("Stream Options");
+	desc.add_options()
+		("output", po::value<string>()->required(), "")
+		("selection", po::value< vector<string> >()->composing(), "")
+		("selection-file", po::value< vector<string> >()->composing(), "")
+		("enable-branches", po::value< vector<string> >()->composing(), "")
+		("disable-branches", po::value< vector<string> >()->composing(), "")
+		("disable-all-branches", po::value<bool>()->implicit_value(true), "")
+	;
+
+	//Open the file and make sure it opens correctly
+	ifstream input_file(path.c_str());
+	if(!input_file.is_open())
+	{
+		cerr << "ERROR: Could not load stream from path: " << path << endl;
+		return false;
+	}
+
+	try
+	{
+		po::store(po::parse_config_file(input_file, desc), stream_options);
+		po::notify(stream_options);
+	}
+	catch(std::exception& e)
+	{
+		cerr << "ERROR: Couldn't parse stream file (" << path << "): " << e.what() << endl;
+		return false;
+	}
+
+	//disable-all-branches is a flag on the command line,
+	//so only keep it if it was actually turned on
+	if(stream_options.count("disable-all-branches") > 0
+	   && !stream_options["disable-all-branches"].as<bool>())
+	{
+		stream_options.erase("disable-all-branches");
+	}
+
+	//Streams inherit the command line verbosity
+	if(verbose)
+	{
+		stream_options.insert(make_pair(string("verbose"), po::variable_value()));
+	}
+
+	return true;
+}
+
+void set_branches_from_options(po::variables_map options, TTree *tree)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Enable all branches
+	if(verbose)
+	{
+		cout << "Enabling all branches" << endl;
+	}
+	tree->SetBranchStatus("*", 1);
+
+	//Disable all branches, if requested
+	if(options.count("disable-all-branches") > 0)
+	{
+		if(verbose)
+		{
+			cout << "Disabling all branches" << endl;
+		}
+		tree->SetBranchStatus("*", 0);
+	}
+
+	//Disable any individually-requested branches
+	if(options.count("disable-branches") > 0)
+	{
+		vector<string> disabled_branches = options["disable-branches"].as< vector<string> >();
+		vector<string>::iterator disabled_branch;
+		for(disabled_branch = disabled_branches.begin();
+			disabled_branch != disabled_branches.end();
+			disabled_branch++)
+		{
+			if(verbose)
+			{
+				cout << "Disabling branch(es): " << *disabled_branch << endl;
+			}
+			tree->SetBranchStatus(disabled_branch->c_str(), 0);
+		}
+	}
+
+	//Enable any individually-requested branches
+	if(options.count("enable-branches") > 0)
+	{
+		vector<string> enabled_branches = options["enable-branches"].as< vector<string> >();
+		vector<string>::iterator enabled_branch;
+		for(enabled_branch = enabled_branches.begin();
+			enabled_branch != enabled_branches.end();
+			enabled_branch++)
+		{
+			if(verbose)
+			{
+				cout << "Enabling branch(es): " << *enabled_branch << endl;
+			}
+			tree->SetBranchStatus(enabled_branch->c_str(), 1);
+		}
+	}
+}
+
+string replace_defines(const string &expression,
+					   const vector< pair<string, string> > &definitions,
+					   const vector<string> &replacements,
+					   vector<bool> &used)
+{
+	//Replace each name which refers to a definition (rather
+	//than to a member, or part of a number) with its
+	//replacement, and note which definitions were used
+	string result;
+	size_t i = 0;
+	while(i < expression.length())
+	{
+		if(isalpha(expression[i]) || expression[i] == '_')
+		{
+			size_t end = i;
+			while(end < expression.length() && (isalnum(expression[end]) || expression[end] == '_'))
+			{
+				end++;
+			}
+			string name = expression.substr(i, end - i);
+			bool member = ((i > 0 && expression[i - 1] == '.')
+						   || (i > 1 && (expression.compare(i - 2, 2, "->") == 0
+										 || expression.compare(i - 2, 2, "::") == 0)));
+			bool replaced = false;
+			for(size_t d = 0; d < definitions.size() && !member && !replaced; d++)
+			{
+				if(definitions[d].first == name)
+				{
+					result += replacements[d];
+					used[d] = true;
+					replaced = true;
+				}
+			}
+			if(!replaced)
+			{
+				result += name;
+			}
+			i = end;
+		}
+		else if(isdigit(expression[i]))
+		{
+			size_t end = i;
+			while(end < expression.length() && (isalnum(expression[end]) || expression[end] == '.'))
+			{
+				end++;
+			}
+			result += expression.substr(i, end - i);
+			i = end;
+		}
+		else
+		{
+			result += expression[i];
+			i++;
+		}
+	}
+	return result;
+}
+
+string expand_defines(const string &expression, const vector< pair<string, string> > &definitions)
+{
+	//Write each definition out in full, in parentheses
+	vector<string> replacements;
+	for(size_t d = 0; d < definitions.size(); d++)
+	{
+		replacements.push_back("(" + definitions[d].second + ")");
+	}
+	vector<bool> used(definitions.size(), false);
+	return replace_defines(expression, definitions, replacements, used);
+}
+
+string parameterize_defines(const string &expression,
+							const vector< pair<string, string> > &definitions,
+							vector<bool> &used)
+{
+	//Refer to each definition by a formula parameter, [d],
+	//so that its value can be computed once and passed in
+	vector<string> replacements;
+	for(size_t d = 0; d < definitions.size(); d++)
+	{
+		ostringstream parameter;
+		parameter << "[" << d << "]";
+		replacements.push_back(parameter.str());
+	}
+	return replace_defines(expression, definitions, replacements, used);
+}
+
+bool get_defines_from_options(po::variables_map options, vector< pair<string, string> > &definitions)
+{
+	//Each is given as NAME=EXPRESSION, and may use the
+	//definitions before it
+	definitions.clear();
+	if(options.count("define") == 0)
+	{
+		return true;
+	}
+	vector<string> specifications = options["define"].as< vector<string> >();
+	vector<string>::iterator specification;
+	for(specification = specifications.begin();
+		specification != specifications.end();
+		specification++)
+	{
+		string::size_type separator = specification->find('=');
+		string name = specification->substr(0, separator);
+		trim(name);
+		if(separator == string::npos || !is_identifier(name))
+		{
+			cerr << "ERROR: Definitions must be given as NAME=EXPRESSION: " << *specification << endl;
+			return false;
+		}
+		for(size_t d = 0; d < definitions.size(); d++)
+		{
+			if(definitions[d].first == name)
+			{
+				cerr << "ERROR: " << name << " is defined more than once." << endl;
+				return false;
+			}
+		}
+		definitions.push_back(make_pair(name, expand_defines(specification->substr(separator + 1), definitions)));
+	}
+	return true;
+}
+
+bool get_selection_cuts_from_options(po::variables_map options, vector<string> &cuts)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Start with no cuts
+	cuts.clear();
+
+	//Loop over command line selection expressions
+	if(options.count("selection") > 0)
+	{
+		vector<string> selections = options["selection"].as< vector<string> >();
+		vector<string>::iterator selection;
+		for(selection = selections.begin();
+			selection != selections.end();
+			selection++)
+		{
+			if(verbose)
+			{
+				cout << "Applying selection: " << *selection << endl;
+			}
+			cuts.push_back(*selection);
+		}
+	}
+
+	//Loop over selection files
+	if(options.count("selection-file") > 0)
+	{
+		vector<string> selection_files = options["selection-file"].as< vector<string> >();
+		vector<string>::iterator selection_file;
+		for(selection_file = selection_files.begin();
+			selection_file != selection_files.end();
+			selection_file++)
+		{
+			//Open the file and make sure it opens correctly
+			ifstream input_file(selection_file->c_str());
+			if(!input_file.is_open())
+			{
+				cerr << "Could not load selection from path: " << *selection_file << endl;
+				return false;
+			}
+
+			//Print information
+			if(verbose)
+			{
+				cout << "Applying selection from file: " << *selection_file << endl;
+			}
+
+			//Go through and read each line
+			string line;
+			while(getline(input_file, line))
+			{
+				//Trim whitespace
+				trim(line);
+
+				//Check for empty lines or comments
+				if(line.length() == 0 || line[0] == '#')
+				{
+					continue;
+				}
+
+				//Add the selection
+				if(verbose)
+				{
+					cout << "\t" << line << endl;
+				}
+
+				cuts.push_back(line);
+			}
+
+			//Close the input file
+			input_file.close();
+		}
+	}
+
+	return true;
+}
+
+bool parse_number(const string &text, double &value)
+{
+	if(text.length() == 0)
+	{
+		return false;
+	}
+	char *end = NULL;
+	value = strtod(text.c_str(), &end);
+	return *end == '\0';
+}
+
+bool parse_range_cut(string cut, RangeCut &range_cut)
+{
+	//Split the cut around its comparison
+	string::size_type start = cut.find_first_of("<>=!");
+	if(start == string::npos)
+	{
+		return false;
+	}
+	string::size_type end = cut.find_first_not_of("<>=!", start);
+	if(end == string::npos)
+	{
+		return false;
+	}
+	string left = cut.substr(0, start);
+	string comparison = cut.substr(start, end - start);
+	string right = cut.substr(end);
+	trim(left);
+	trim(right);
+	if(comparison != "<" && comparison != "<="
+	   && comparison != ">" && comparison != ">="
+	   && comparison != "==")
+	{
+		return false;
+	}
+
+	//Put the branch on the left
+	if(is_identifier(left) && parse_number(right, range_cut.value))
+	{
+		range_cut.branch = left;
+		range_cut.comparison = comparison;
+		return true;
+	}
+	if(is_identifier(right) && parse_number(left, range_cut.value))
+	{
+		range_cut.branch = right;
+		range_cut.comparison = comparison;
+		if(comparison[0] == '<')
+		{
+			range_cut.comparison[0] = '>';
+		}
+		else if(comparison[0] == '>')
+		{
+			range_cut.comparison[0] = '<';
+		}
+		return true;
+	}
+	return false;
+}
+
+bool add_inputs_from_list(po::variables_map options, TChain *chain)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string input_list = options["input-list"].as<string>();
+
+	//Open the list
+	ifstream list(input_list.c_str());
+	if(!list.is_open())
+	{
+		cerr << "ERROR: Unable to open the input list (" << input_list << ") for reading." << endl;
+		return false;
+	}
+
+	//Find the cuts which metadata can be checked against.
+	//A cutflow has to see every entry, so nothing is
+	//skipped for one.  An entry list gives entries of the
+	//whole input list, and a cluster index describes it
+	//file by file, so neither can have files missing.
+	vector<RangeCut> range_cuts;
+	if(options.count("cutflow") > 0 || options.count("cutflow-weight") > 0)
+	{
+		if(verbose)
+		{
+			cout << "Not skipping input files, since a cutflow was requested" << endl;
+		}
+	}
+	else if(options.count("entry-list-output") > 0)
+	{
+		if(verbose)
+		{
+			cout << "Not skipping input files, since an entry list was requested" << endl;
+		}
+	}
+	else if(options.count("cluster-index") > 0)
+	{
+		if(verbose)
+		{
+			cout << "Not skipping input files, since a cluster index is used" << endl;
+		}
+	}
+	else
+	{
+		get_range_cuts_from_options(options, range_cuts);
+	}
+
+	//Each line gives a path or URL, optionally followed by
+	//the number of entries in the file and the range of any
+	//branches, as BRANCH=MIN:MAX
+	int added = 0;
+	int skipped = 0;
+	string line;
+	while(getline(list, line))
+	{
+		trim(line);
+		if(line.length() == 0 || line[0] == '#')
+		{
+			continue;
+		}
+		istringstream fields(line);
+		string path;
+		fields >> path;
+		Long64_t entries = -1;
+		map<string, BranchRange> ranges;
+		string field;
+		while(fields >> field)
+		{
+			string::size_type equals = field.find('=');
+			string::size_type colon = field.find(':', equals);
+			double value = 0;
+			if(equals == string::npos && entries < 0 && parse_number(field, value) && value >= 0)
+			{
+				entries = (Long64_t)value;
+				continue;
+			}
+			BranchRange range;
+			if(equals == string::npos || colon == string::npos
+			   || !parse_number(field.substr(equals + 1, colon - equals - 1), range.minimum)
+			   || !parse_number(field.substr(colon + 1), range.maximum))
+			{
+				cerr << "ERROR: Malformed input list entry: " << line << endl;
+				return false;
+			}
+			ranges[field.substr(0, equals)] = range;
+		}
+
+		//Skip the file if its metadata shows no entry in it
+		//can pass the selection
+		bool can_pass = true;
+		vector<RangeCut>::iterator range_cut;
+		for(range_cut = range_cuts.begin();
+			range_cut != range_cuts.end() && can_pass;
+			range_cut++)
+		{
+			map<string, BranchRange>::iterator range = ranges.find(range_cut->branch);
+			can_pass = (range == ranges.end() || range_can_pass(range->second, *range_cut));
+		}
+		if(!can_pass)
+		{
+			if(verbose)
+			{
+				cout << "Skipping " << path << ", no entries can pass the selection" << endl;
+			}
+			skipped++;
+			continue;
+		}
+
+		//Add the file.  With an entry count, it isn't opened
+		//until the chain gets to it.
+		Int_t result = (entries >= 0) ? chain->AddFile(path.c_str(), entries) : chain->AddFile(path.c_str());
+		if(result != 1)
+		{
+			cerr << "ERROR: Unable to add the input file (" << path << ")." << endl;
+			return false;
+		}
+		added++;
+	}
+
+	if(verbose)
+	{
+		cout << "Added " << added << " files from the input list";
+		if(skipped > 0)
+		{
+			cout << ", skipped " << skipped;
+		}
+		cout << endl;
+	}
+	if(added == 0)
+	{
+		//ROOT can't handle an empty chain
+		cerr << "ERROR: No input files in the list (or none which could pass the selection)" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+TTreeFormula * create_selection_formula(string selection, TTree *tree)
+{
+	//Create the result
+	TTreeFormula *result = new TTreeFormula("selection", selection.c_str(), tree);
+
+	//Check that it compiled correctly (hopefully
+	//this check will continue to work)
+	if(result->GetTree() == NULL)
+	{
+		cerr << "ERROR: Selection did not compile correctly." << endl;
+		delete result;
+		return NULL;
+	}
+
+	return result;
+}
+
+void get_formula_branches(TTreeFormula *formula, set<string> &branches)
+{
+	//Each leaf referenced by the formula (including the
+	//counters of variable-length arrays) lives in a
+	//branch that must be read to evaluate it
+	for(Int_t i = 0; i < formula->GetNcodes(); i++)
+	{
+		TLeaf *leaf = formula->GetLeaf(i);
+		if(leaf == NULL)
+		{
+			continue;
+		}
+		branches.insert(leaf->GetBranch()->GetName());
+		if(leaf->GetLeafCount() != NULL)
+		{
+			branches.insert(leaf->GetLeafCount()->GetBranch()->GetName());
+		}
+	}
+}
+
+void enable_only_branches(TTree *tree, const set<string> &branches)
+{
+	tree->SetBranchStatus("*", 0);
+	set<string>::const_iterator branch;
+	for(branch = branches.begin();
+		branch != branches.end();
+		branch++)
+	{
+		tree->SetBranchStatus(branch->c_str(), 1);
+	}
+}
+
+void get_enabled_branches(TTree *tree, set<string> &branches)
+{
+	//The list of branches is only available once a tree
+	//in the chain is loaded
+	tree->LoadTree(0);
+	TObjArray *tree_branches = tree->GetListOfBranches();
+	if(tree_branches == NULL)
+	{
+		return;
+	}
+	for(Int_t i = 0; i < tree_branches->GetEntriesFast(); i++)
+	{
+		TBranch *branch = (TBranch *)tree_branches->UncheckedAt(i);
+		if(tree->GetBranchStatus(branch->GetName()))
+		{
+			branches.insert(branch->GetName());
+		}
+	}
+}
+
+Long64_t get_memory_budget(po::variables_map options, double fraction)
+{
+	//The share of --max-memory given to one component, or
+	//-1 if memory isn't bounded
+	if(options.count("max-memory") == 0)
+	{
+		return -1;
+	}
+	return (Long64_t)(options["max-memory"].as<Long64_t>() * fraction);
+}
+
+Long64_t get_basket_memory(TObjArray *branches)
+{
+	//Each branch keeps a basket buffer in memory, which
+	//fills until it is flushed to the file
+	Long64_t memory = 0;
+	for(Int_t i = 0; i < branches->GetEntriesFast(); i++)
+	{
+		TBranch *branch = (TBranch *)branches->UncheckedAt(i);
+		memory += branch->GetBasketSize();
+		memory += get_basket_memory(branch->GetListOfBranches());
+	}
+	return memory;
+}
+
+Long64_t get_buffered_memory(TObjArray *branches)
+{
+	//The bytes actually filled into each branch's current
+	//basket, which is all a tree being written keeps in
+	//memory
+	Long64_t memory = 0;
+	for(Int_t i = 0; i < branches->GetEntriesFast(); i++)
+	{
+		TBranch *branch = (TBranch *)branches->UncheckedAt(i);
+		TBasket *basket = (TBasket *)branch->GetListOfBaskets()->At(branch->GetWriteBasket());
+		if(basket != NULL && basket->GetBufferRef() != NULL)
+		{
+			memory += basket->GetBufferRef()->Length();
+		}
+		memory += get_buffered_memory(branch->GetListOfBranches());
+	}
+	return memory;
+}
+
+void configure_cache_from_options(po::variables_map options, TTree *tree, const set<string> &branches)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	if(options.count("cache-size") == 0
+	   && options.count("cache-branches") == 0
+	   && options.count("prefetch") == 0)
+	{
+		return;
+	}
+	Long64_t cache_size = DEFAULT_CACHE_SIZE;
+	if(options.count("cache-size") > 0)
+	{
+		cache_size = options["cache-size"].as<Long64_t>();
+	}
+
+	//Keep the cache within its share of the memory ceiling
+	Long64_t cache_budget = get_memory_budget(options, MEMORY_CACHE_FRACTION);
+	if(cache_budget >= 0 && cache_size > cache_budget)
+	{
+		if(verbose)
+		{
+			cout << "Limiting the TTreeCache to " << cache_budget << " bytes" << endl;
+		}
+		cache_size = cache_budget;
+	}
+
+	//Create the cache.  It is attached to the current
+	//file, so make sure one is loaded.
+	if(verbose)
+	{
+		cout << "Using a " << cache_size << " byte TTreeCache" << endl;
+	}
+	tree->LoadTree(0);
+	tree->SetCacheSize(cache_size);
+
+	//Register the branches we know will be read
+	set<string>::const_iterator branch;
+	for(branch = branches.begin();
+		branch != branches.end();
+		branch++)
+	{
+		tree->AddBranchToCache(branch->c_str(), kTRUE);
+	}
+
+	//Register any additional user-requested branches
+	if(options.count("cache-branches") > 0)
+	{
+		vector<string> cache_branches = options["cache-branches"].as< vector<string> >();
+		vector<string>::iterator cache_branch;
+		for(cache_branch = cache_branches.begin();
+			cache_branch != cache_branches.end();
+			cache_branch++)
+		{
+			if(verbose)
+			{
+				cout << "Caching branch(es): " << *cache_branch << endl;
+			}
+			tree->AddBranchToCache(cache_branch->c_str(), kTRUE);
+		}
+	}
+
+	//We've told the cache everything it needs, so there
+	//is no need for it to learn
+	tree->StopCacheLearningPhase();
+}
+
+bool configure_output_threads_from_options(po::variables_map options)
+{
+	//Determine operating parameters
+	if(options.count("output-threads") == 0)
+	{
+		return true;
+	}
+	int output_threads = options["output-threads"].as<int>();
+	if(output_threads < 0)
+	{
+		cerr << "ERROR: Number of output threads must be >= 0 to make sense" << endl;
+		return false;
+	}
+
+	//With implicit multi-threading, each tree compresses
+	//its baskets in parallel (on ROOT's thread pool) when it
+	//flushes them, rather than one at a time on the thread
+	//calling Fill
+#ifdef R__USE_IMT
+	bool verbose = (options.count("verbose") > 0);
+	ROOT::EnableImplicitMT(output_threads);
+	if(verbose)
+	{
+		cout << "Compressing output with " << ROOT::GetThreadPoolSize() << " threads" << endl;
+	}
+	return true;
+#else
+	cerr << "ERROR: This ROOT was built without implicit multi-threading, which is needed for --output-threads" << endl;
+	return false;
+#endif
+}
+
+bool parse_compression_settings(string specification, int &settings)
+{
+	//Check for a purely numeric setting
+	trim(specification);
+	if(specification.length() > 0
+	   && specification.find_first_not_of("0123456789") == string::npos)
+	{
+		settings = atoi(specification.c_str());
+		return true;
+	}
+
+	//Split off the level, if any
+	string algorithm = specification;
+	int level = -1;
+	string::size_type separator = specification.find(':');
+	if(separator != string::npos)
+	{
+		algorithm = specification.substr(0, separator);
+		string level_string = specification.substr(separator + 1);
+		if(level_string.length() == 0
+		   || level_string.find_first_not_of("0123456789") != string::npos)
+		{
+			cerr << "ERROR: Invalid compression level: " << level_string << endl;
+			return false;
+		}
+		level = atoi(level_string.c_str());
+		if(level > 9)
+		{
+			cerr << "ERROR: Compression level must be between 0 and 9" << endl;
+			return false;
+		}
+	}
+	to_upper(algorithm);
+
+	//Settings are encoded as 100 * algorithm + level, with
+	//ROOT's recommended default level for each algorithm
+	int algorithm_code = 0;
+	int default_level = 0;
+	if(algorithm == "ZLIB")
+	{
+		algorithm_code = 1;
+		default_level = 1;
+	}
+	else if(algorithm == "LZMA")
+	{
+		algorithm_code = 2;
+		default_level = 7;
+	}
+	else if(algorithm == "LZ4")
+	{
+		algorithm_code = 4;
+		default_level = 4;
+	}
+	else if(algorithm == "ZSTD")
+	{
+		algorithm_code = 5;
+		default_level = 5;
+	}
+	else if(algorithm == "NONE")
+	{
+		settings = 0;
+		return true;
+	}
+	else
+	{
+		cerr << "ERROR: Unknown compression algorithm: " << algorithm << endl;
+		return false;
+	}
+
+	settings = 100 * algorithm_code + (level >= 0 ? level : default_level);
+	return true;
+}
+
+void set_branch_compression(TTree *tree, string pattern, int settings)
+{
+	//Setting compression on a branch also sets it on all
+	//of its sub-branches
+	TRegexp regexp(pattern.c_str(), kTRUE);
+	TObjArray *branches = tree->GetListOfBranches();
+	for(Int_t i = 0; i < branches->GetEntriesFast(); i++)
+	{
+		TBranch *branch = (TBranch *)branches->UncheckedAt(i);
+		TString name = branch->GetName();
+		Ssiz_t length = 0;
+		if(regexp.Index(name, &length) == 0 && length == name.Length())
+		{
+			branch->SetCompressionSettings(settings);
+		}
+	}
+}
+
+bool set_compression_from_options(po::variables_map options, TFile *file, TTree *tree)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Set the compression for the whole file.  Cloned
+	//branches keep the compression of the input, so they
+	//need to be set explicitly as well.
+	if(options.count("compression") > 0)
+	{
+		int settings = 0;
+		if(!parse_compression_settings(options["compression"].as<string>(), settings))
+		{
+			return false;
+		}
+		if(verbose)
+		{
+			cout << "Output compression: " << settings << endl;
+		}
+		file->SetCompressionSettings(settings);
+		set_branch_compression(tree, "*", settings);
+	}
+
+	//Apply any per-branch overrides
+	if(options.count("branch-compression") > 0)
+	{
+		vector<string> overrides = options["branch-compression"].as< vector<string> >();
+		vector<string>::iterator branch_override;
+		for(branch_override = overrides.begin();
+			branch_override != overrides.end();
+			branch_override++)
+		{
+			string::size_type separator = branch_override->rfind('=');
+			if(separator == string::npos)
+			{
+				cerr << "ERROR: Branch compression must be given as BRANCH=ALGORITHM[:LEVEL]: " << *branch_override << endl;
+				return false;
+			}
+			string pattern = branch_override->substr(0, separator);
+			int settings = 0;
+			if(!parse_compression_settings(branch_override->substr(separator + 1), settings))
+			{
+				return false;
+			}
+			if(verbose)
+			{
+				cout << "Output compression for branch(es) " << pattern << ": " << settings << endl;
+			}
+			set_branch_compression(tree, pattern, settings);
+		}
+	}
+
+	return true;
+}
+
+bool set_basket_layout_from_options(po::variables_map options, TTree *tree)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Set the basket size for all branches
+	if(options.count("basket-size") > 0)
+	{
+		int basket_size = options["basket-size"].as<int>();
+		if(basket_size <= 0)
+		{
+			cerr << "ERROR: Basket size must be > 0 to make sense" << endl;
+			return false;
+		}
+		if(verbose)
+		{
+			cout << "Output basket size: " << basket_size << endl;
+		}
+		tree->SetBasketSize("*", basket_size);
+	}
+
+	//Set the auto-flush interval
+	if(options.count("auto-flush") > 0)
+	{
+		Long64_t auto_flush = options["auto-flush"].as<Long64_t>();
+		if(verbose)
+		{
+			cout << "Output auto-flush: " << auto_flush << endl;
+		}
+		tree->SetAutoFlush(auto_flush);
+	}
+
+	//Keep the output baskets within this tree's share of
+	//the memory ceiling: shrink them if there are too many
+	//branches for their size, and otherwise flush them
+	//whenever they hold that much
+	Long64_t output_budget = get_memory_budget(options, MEMORY_OUTPUT_FRACTION);
+	if(output_budget >= 0)
+	{
+		if(options.count("stream") > 0)
+		{
+			output_budget /= (Long64_t)(options["stream"].as< vector<string> >().size() + 1);
+		}
+		Int_t n_leaves = tree->GetListOfLeaves()->GetEntriesFast();
+		if(options.count("basket-size") == 0 && n_leaves > 0
+		   && get_basket_memory(tree->GetListOfBranches()) > output_budget)
+		{
+			int basket_size = (int)max(output_budget / n_leaves, (Long64_t)MINIMUM_BOUNDED_BASKET_SIZE);
+			if(verbose)
+			{
+				cout << "Limiting the output basket size to " << basket_size << endl;
+			}
+			tree->SetBasketSize("*", basket_size);
+		}
+		if(options.count("auto-flush") == 0)
+		{
+			if(verbose)
+			{
+				cout << "Flushing the output every " << output_budget << " bytes" << endl;
+			}
+			tree->SetAutoFlush(-output_budget);
+		}
+	}
+
+	return true;
+}
+
+//Opens the next file of a chain in the background
+//whenever the chain moves to a new file, so that the
+//chain finds it already open (TFile::Open picks up a
+//pending asynchronous open of the same URL) rather than
+//stalling on it
+class FilePrefetcher : public TObject
+{
+	public:
+		FilePrefetcher(TChain *chain, bool verbose) :
+			chain(chain),
+			verbose(verbose),
+			requested(-1)
+		{
+		}
+
+		Bool_t Notify()
+		{
+			Int_t next = chain->GetTreeNumber() + 1;
+			TObjArray *files = chain->GetListOfFiles();
+			if(next <= requested || next >= files->GetEntries())
+			{
+				return kTRUE;
+			}
+			const char *name = files->At(next)->GetTitle();
+			if(verbose)
+			{
+				cout << "Prefetching " << name << endl;
+			}
+			TFile::AsyncOpen(name);
+			requested = next;
+			return kTRUE;
+		}
+
+	private:
+		TChain *chain;
+		bool verbose;
+		Int_t requested;
+};
+
+//Reads an entry of a chain's current tree a branch at a
+//time, skipping any branch which has already been read
+//for that entry (by the selection formulas, which read
+//into the same addresses).  The branch list is rebuilt
+//whenever the chain moves to a new tree.
+class EntryReader : public TObject
+{
+	public:
+		EntryReader(TChain *chain) :
+			chain(chain)
+		{
+		}
+
+		Bool_t Notify()
+		{
+			branches.clear();
+			TTree *tree = chain->GetTree();
+			if(tree == NULL)
+			{
+				return kTRUE;
+			}
+			TObjArray *tree_branches = tree->GetListOfBranches();
+			for(Int_t b = 0; b < tree_branches->GetEntriesFast(); b++)
+			{
+				TBranch *branch = (TBranch *)tree_branches->UncheckedAt(b);
+				if(!branch->TestBit(kDoNotProcess))
+				{
+					branches.push_back(branch);
+				}
+			}
+			return kTRUE;
+		}
+
+		inline Int_t Read(Long64_t entry, Long64_t local_entry)
+		{
+			//With implicit multi-threading, TTree::GetEntry
+			//unzips the branches in parallel, which is worth
+			//more than skipping a few
+#ifdef R__USE_IMT
+			if(ROOT::IsImplicitMTEnabled())
+			{
+				return chain->GetEntry(entry);
+			}
+#endif
+			Int_t bytes = 0;
+			vector<TBranch *>::iterator branch;
+			for(branch = branches.begin();
+				branch != branches.end();
+				branch++)
+			{
+				if((*branch)->GetReadEntry() == local_entry)
+				{
+					continue;
+				}
+				Int_t branch_bytes = (*branch)->GetEntry(local_entry);
+				if(branch_bytes < 0)
+				{
+					return -1;
+				}
+				bytes += branch_bytes;
+			}
+			return bytes;
+		}
+
+	private:
+		TChain *chain;
+		vector<TBranch *> branches;
+};
+
+//Removes the elements failing a per-element selection
+//from a vector, in place, so that no memory is allocated
+template<class T>
+bool filter_vector(void *object, const vector<char> &mask)
+{
+	vector<T> &values = *(vector<T> *)object;
+	if(values.size() != mask.size())
+	{
+		return false;
+	}
+	size_t kept = 0;
+	for(size_t i = 0; i < values.size(); i++)
+	{
+		if(mask[i])
+		{
+			values[kept++] = values[i];
+		}
+	}
+	values.resize(kept);
+	return true;
+}
+
+typedef bool (*VectorFilter)(void *, const vector<char> &);
+
+VectorFilter get_vector_filter(string class_name)
+{
+	if(class_name == "vector<float>") return filter_vector<float>;
+	if(class_name == "vector<double>") return filter_vector<double>;
+	if(class_name == "vector<int>") return filter_vector<int>;
+	if(class_name == "vector<unsigned int>") return filter_vector<unsigned int>;
+	if(class_name == "vector<short>") return filter_vector<short>;
+	if(class_name == "vector<unsigned short>") return filter_vector<unsigned short>;
+	if(class_name == "vector<char>") return filter_vector<char>;
+	if(class_name == "vector<unsigned char>") return filter_vector<unsigned char>;
+	if(class_name == "vector<long>") return filter_vector<long>;
+	if(class_name == "vector<unsigned long>") return filter_vector<unsigned long>;
+	if(class_name == "vector<Long64_t>" || class_name == "vector<long long>") return filter_vector<Long64_t>;
+	if(class_name == "vector<ULong64_t>" || class_name == "vector<unsigned long long>") return filter_vector<ULong64_t>;
+	if(class_name == "vector<bool>") return filter_vector<bool>;
+	return NULL;
+}
+
+//Overwrites the count of a collection with the number of
+//elements an object selection kept, as long as it was the
+//number there were before
+template<class T>
+bool update_count(void *address, size_t count, size_t kept)
+{
+	T &value = *(T *)address;
+	if((size_t)value != count)
+	{
+		return false;
+	}
+	value = (T)kept;
+	return true;
+}
+
+typedef bool (*CountUpdate)(void *, size_t, size_t);
+
+CountUpdate get_count_update(string type_name)
+{
+	if(type_name == "Int_t") return update_count<Int_t>;
+	if(type_name == "UInt_t") return update_count<UInt_t>;
+	if(type_name == "Short_t") return update_count<Short_t>;
+	if(type_name == "UShort_t") return update_count<UShort_t>;
+	if(type_name == "Char_t") return update_count<Char_t>;
+	if(type_name == "UChar_t") return update_count<UChar_t>;
+	if(type_name == "Long_t") return update_count<Long_t>;
+	if(type_name == "ULong_t") return update_count<ULong_t>;
+	if(type_name == "Long64_t") return update_count<Long64_t>;
+	if(type_name == "ULong64_t") return update_count<ULong64_t>;
+	return NULL;
+}
+
+//A vector branch filtered by an object selection
+struct ObjectBranch
+{
+	TBranchElement *branch;
+	VectorFilter filter;
+	bool warned;
+};
+
+//The scalar integer branch named as the count of the
+//collection (e.g. jet_n), kept in step with the filtering
+struct ObjectCount
+{
+	TLeaf *leaf;
+	CountUpdate update;
+	bool warned;
+};
+
+//A per-element selection applied to every vector branch
+//whose name starts with a prefix, so that the elements of
+//a collection (e.g. all the jet_ branches) are kept or
+//dropped consistently.  The vectors are filtered in place
+//after they are read, so the output tree (which shares
+//their addresses) writes the filtered collection.  Only a
+//count branch named by the user is updated, since other
+//integers with the prefix (e.g. jet_nTight) may equal the
+//number of elements by chance.  Other scalars with the
+//prefix are left alone, and any other branch with the
+//prefix (C-style arrays, for example) can't be filtered.
+class ObjectSelection : public TObject
+{
+	public:
+		ObjectSelection(string prefix, string count_name, TTreeFormula *formula, TChain *chain) :
+			prefix(prefix),
+			count_name(count_name),
+			formula(formula),
+			chain(chain),
+			checked(false),
+			warned(false),
+			count_warned(false)
+		{
+			Notify();
+		}
+
+		~ObjectSelection()
+		{
+			delete formula;
+		}
+
+		TTreeFormula * GetFormula() const
+		{
+			return formula;
+		}
+
+		string GetPrefix() const
+		{
+			return prefix;
+		}
+
+		//The first branch with the prefix which can't be
+		//filtered, if there is one
+		string GetUnfiltered() const
+		{
+			return unfiltered;
+		}
+
+		//Whether the count branch, if one was named, was
+		//found and can be updated
+		bool HasCount() const
+		{
+			return count_name.length() == 0 || !counts.empty();
+		}
+
+		Bool_t Notify()
+		{
+			formula->Notify();
+
+			//Find the vector and count branches of the new
+			//tree
+			branches.clear();
+			counts.clear();
+			unfiltered.clear();
+			TTree *tree = chain->GetTree();
+			if(tree == NULL)
+			{
+				return kTRUE;
+			}
+			TObjArray *tree_branches = tree->GetListOfBranches();
+			for(Int_t b = 0; b < tree_branches->GetEntriesFast(); b++)
+			{
+				TBranch *branch = (TBranch *)tree_branches->UncheckedAt(b);
+				if(branch->TestBit(kDoNotProcess)
+				   || !starts_with(string(branch->GetName()), prefix))
+				{
+					continue;
+				}
+				TBranchElement *element = dynamic_cast<TBranchElement *>(branch);
+				if(element != NULL)
+				{
+					ObjectBranch object_branch;
+					object_branch.branch = element;
+					object_branch.filter = get_vector_filter(element->GetClassName());
+					object_branch.warned = false;
+					if(object_branch.filter != NULL)
+					{
+						branches.push_back(object_branch);
+						continue;
+					}
+				}
+				else if(branch->GetNleaves() == 1)
+				{
+					TLeaf *leaf = (TLeaf *)branch->GetListOfLeaves()->UncheckedAt(0);
+					if(leaf->GetLeafCount() == NULL && leaf->GetLenStatic() == 1)
+					{
+						continue;
+					}
+				}
+				if(unfiltered.length() == 0)
+				{
+					unfiltered = branch->GetName();
+				}
+			}
+
+			//Find the count, which needn't have the prefix
+			TBranch *count_branch = NULL;
+			if(count_name.length() > 0)
+			{
+				count_branch = tree->GetBranch(count_name.c_str());
+			}
+			if(count_branch != NULL
+			   && !count_branch->TestBit(kDoNotProcess)
+			   && dynamic_cast<TBranchElement *>(count_branch) == NULL
+			   && count_branch->GetNleaves() == 1)
+			{
+				ObjectCount count;
+				count.leaf = (TLeaf *)count_branch->GetListOfLeaves()->UncheckedAt(0);
+				count.update = get_count_update(count.leaf->GetTypeName());
+				count.warned = false;
+				if(count.update != NULL
+				   && count.leaf->GetLeafCount() == NULL
+				   && count.leaf->GetLenStatic() == 1)
+				{
+					counts.push_back(count);
+				}
+			}
+
+			//These are only errors for the first tree, later
+			//ones just aren't filtered fully
+			if(unfiltered.length() > 0 && checked && !warned)
+			{
+				cerr << "WARNING: " << unfiltered << " isn't a vector, so it isn't being filtered." << endl;
+				warned = true;
+			}
+			if(!HasCount() && checked && !count_warned)
+			{
+				cerr << "WARNING: " << count_name << " isn't an integer branch, so it isn't being updated." << endl;
+				count_warned = true;
+			}
+			checked = true;
+			return kTRUE;
+		}
+
+		void Evaluate()
+		{
+			//Each selection evaluates every element before any
+			//collection is filtered, since the selections read
+			//the vectors being filtered
+			Int_t n_elements = formula->GetNdata();
+			mask.resize(n_elements);
+			kept = 0;
+			for(Int_t i = 0; i < n_elements; i++)
+			{
+				mask[i] = (formula->EvalInstance(i) != 0);
+				kept += mask[i];
+			}
+		}
+
+		void Apply()
+		{
+			vector<ObjectBranch>::iterator branch;
+			for(branch = branches.begin();
+				branch != branches.end();
+				branch++)
+			{
+				void *object = branch->branch->GetObject();
+				if(object != NULL && !branch->filter(object, mask) && !branch->warned)
+				{
+					cerr << "WARNING: " << branch->branch->GetName() << " doesn't have one element per"
+						 << " object, so it isn't being filtered." << endl;
+					branch->warned = true;
+				}
+			}
+			vector<ObjectCount>::iterator count;
+			for(count = counts.begin();
+				count != counts.end();
+				count++)
+			{
+				void *address = count->leaf->GetValuePointer();
+				if(address != NULL && !count->update(address, mask.size(), kept) && !count->warned)
+				{
+					cerr << "WARNING: " << count->leaf->GetName() << " isn't the number of objects,"
+						 << " so it isn't being updated." << endl;
+					count->warned = true;
+				}
+			}
+		}
+
+	private:
+		string prefix;
+		string count_name;
+		TTreeFormula *formula;
+		TChain *chain;
+		vector<ObjectBranch> branches;
+		vector<ObjectCount> counts;
+		string unfiltered;
+		bool checked;
+		bool warned;
+		bool count_warned;
+		vector<char> mask;
+		size_t kept;
+};
+
+bool create_object_selections_from_options(po::variables_map options,
+										   TChain *chain,
+										   vector< boost::shared_ptr<ObjectSelection> > &object_selections)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	if(options.count("object-selection") == 0)
+	{
+		return true;
+	}
+
+	//Each is given as PREFIX:EXPRESSION, or with the count
+	//as PREFIX:COUNT:EXPRESSION.  An expression can contain
+	//colons (e.g. TMath::Abs), so a count is only taken if
+	//it's a name followed by a single colon.
+	vector<string> specifications = options["object-selection"].as< vector<string> >();
+	vector<string>::iterator specification;
+	for(specification = specifications.begin();
+		specification != specifications.end();
+		specification++)
+	{
+		string::size_type separator = specification->find(':');
+		if(separator == string::npos || separator == 0)
+		{
+			cerr << "ERROR: Object selections must be given as PREFIX:EXPRESSION"
+				 << " or PREFIX:COUNT:EXPRESSION: " << *specification << endl;
+			return false;
+		}
+		string prefix = specification->substr(0, separator);
+		string expression = specification->substr(separator + 1);
+		string count_name;
+		string::size_type count_separator = expression.find(':');
+		if(count_separator != string::npos
+		   && is_identifier(expression.substr(0, count_separator))
+		   && expression.compare(count_separator, 2, "::") != 0)
+		{
+			count_name = expression.substr(0, count_separator);
+			expression = expression.substr(count_separator + 1);
+		}
+		if(verbose)
+		{
+			cout << "Applying object selection to " << prefix << "*: " << expression << endl;
+			if(count_name.length() > 0)
+			{
+				cout << "Updating " << count_name << " to the number of objects kept" << endl;
+			}
+		}
+		for(size_t o = 0; o < object_selections.size(); o++)
+		{
+			//All the masks are computed before anything is
+			//filtered, so a branch can only be filtered once
+			string other = object_selections[o]->GetPrefix();
+			if(starts_with(prefix, other) || starts_with(other, prefix))
+			{
+				cerr << "ERROR: Object selections on " << prefix << "* and " << other << "* overlap." << endl;
+				return false;
+			}
+		}
+		TTreeFormula *formula = create_selection_formula(expression, chain);
+		if(formula == NULL)
+		{
+			return false;
+		}
+		boost::shared_ptr<ObjectSelection> object_selection(new ObjectSelection(prefix, count_name, formula, chain));
+		if(object_selection->GetUnfiltered().length() > 0)
+		{
+			cerr << "ERROR: Object selection on " << prefix << "* can't filter " << object_selection->GetUnfiltered()
+				 << ", which isn't a vector or a scalar.  Use a longer prefix or drop the branch." << endl;
+			return false;
+		}
+		if(!object_selection->HasCount())
+		{
+			cerr << "ERROR: The count of an object selection (" << count_name << ") must be an enabled,"
+				 << " scalar integer branch." << endl;
+			return false;
+		}
+		object_selections.push_back(object_selection);
+	}
+
+	return true;
+}
+
+void configure_prefetch_from_options(po::variables_map options)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	if(options.count("prefetch") == 0)
+	{
+		return;
+	}
+
+	//Have the TTreeCache read its baskets in a background
+	//thread, keeping a local copy of each block read if a
+	//cache directory is given.  This has to be set before
+	//any cache is created.
+	gEnv->SetValue("TFile.AsyncPrefetching", 1);
+	if(options.count("prefetch-cache-dir") > 0)
+	{
+		string cache_dir = options["prefetch-cache-dir"].as<string>();
+		if(verbose)
+		{
+			cout << "Caching prefetched blocks in " << cache_dir << endl;
+		}
+		gEnv->SetValue("Cache.Directory", cache_dir.c_str());
+	}
+}
+
+FilePrefetcher * create_prefetcher_from_options(po::variables_map options, TChain *chain)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	if(options.count("prefetch") == 0)
+	{
+		return NULL;
+	}
+
+	return new FilePrefetcher(chain, verbose);
+}
+
+inline bool is_selected(TTreeFormula *selector, CompiledSelection *compiled, Long64_t local_entry)
+{
+	if(compiled != NULL)
+	{
+		return compiled->Select(selector, local_entry);
+	}
+	return selector->EvalInstance(0) != 0;
+}
+
+//One cut of a staged selection.  The counters are used
+//to reorder the stages.
+struct SelectionStage
+{
+	string expression;
+	TTreeFormula *formula;
+	CompiledSelection *compiled;
+	Long64_t evaluated;
+	Long64_t passed;
+	Double_t weighted_passed;
+	Long64_t timed;
+	Double_t time;
+};
+
+//The selection of an output stream.  The combined formula
+//(the product of all of the cuts) is always created, since
+//it is used to find the branches the selection reads.  When
+//short-circuiting, each cut is also created as a separate
+//stage, and evaluation stops at the first failing stage.
+//For a cutflow, the stages are kept in their original
+//order and their pass counts are reported.
+struct Selection
+{
+	vector<string> cuts;
+	string expression;
+	TTreeFormula *formula;
+	CompiledSelection *compiled;
+	vector<SelectionStage> stages;
+	bool reorder;
+	bool cutflow;
+	bool verbose;
+	TTreeFormula *weight;
+	vector<TTreeFormula *> parameters;
+	vector<Double_t> parameter_values;
+	Long64_t evaluations;
+	Double_t weighted_evaluations;
+	Long64_t next_reorder;
+};
+
+string combine_cuts(const vector<string> &cuts)
+{
+	string result = TRIVIAL_SELECTION;
+	vector<string>::const_iterator cut;
+	for(cut = cuts.begin();
+		cut != cuts.end();
+		cut++)
+	{
+		result += "*(" + *cut + ")";
+	}
+	return result;
+}
+
+void init_selection(Selection &selection)
+{
+	selection.formula = NULL;
+	selection.compiled = NULL;
+	selection.reorder = false;
+	selection.cutflow = false;
+	selection.verbose = false;
+	selection.weight = NULL;
+	selection.parameters.clear();
+	selection.parameter_values.clear();
+	selection.evaluations = 0;
+	selection.weighted_evaluations = 0;
+	selection.next_reorder = STAGE_REORDER_INTERVAL;
+}
+
+void delete_selection(Selection &selection)
+{
+	vector<SelectionStage>::iterator stage;
+	for(stage = selection.stages.begin();
+		stage != selection.stages.end();
+		stage++)
+	{
+		delete stage->compiled;
+		delete stage->formula;
+	}
+	selection.stages.clear();
+	vector<TTreeFormula *>::iterator parameter;
+	for(parameter = selection.parameters.begin();
+		parameter != selection.parameters.end();
+		parameter++)
+	{
+		delete *parameter;
+	}
+	selection.parameters.clear();
+	delete selection.weight;
+	delete selection.compiled;
+	delete selection.formula;
+	selection.weight = NULL;
+	selection.compiled = NULL;
+	selection.formula = NULL;
+}
+
+bool create_selection(po::variables_map options,
+					  const vector<string> &cuts,
+					  TTree *tree,
+					  Selection &selection)
+{
+	//Determine operating parameters.  A cutflow needs the
+	//stages in their original order.
+	bool cutflow = (options.count("cutflow") > 0 || options.count("cutflow-weight") > 0);
+	bool short_circuit = (cutflow
+						  || options.count("short-circuit") > 0
+						  || options.count("reorder-cuts") > 0);
+	bool compile = (options.count("compile-selection") > 0 || options.count("batch-size") > 0);
+	init_selection(selection);
+	selection.cuts = cuts;
+	selection.reorder = (!cutflow && options.count("reorder-cuts") > 0);
+	selection.cutflow = cutflow;
+	selection.verbose = (options.count("verbose") > 0);
+
+	//Any definitions the cuts use are computed once for
+	//each entry, before the cuts, which take them as
+	//parameters.  The value is then reused for the output.
+	//A compiled selection has them written out instead,
+	//since it is only given leaves.  The expression always
+	//has them written out, so that it describes the
+	//selection fully.
+	vector< pair<string, string> > definitions;
+	if(!get_defines_from_options(options, definitions))
+	{
+		return false;
+	}
+	vector<string> expanded_cuts;
+	vector<string> formula_cuts;
+	vector<bool> used(definitions.size(), false);
+	vector<string>::const_iterator cut;
+	for(cut = cuts.begin();
+		cut != cuts.end();
+		cut++)
+	{
+		expanded_cuts.push_back(expand_defines(*cut, definitions));
+		formula_cuts.push_back(compile ? expanded_cuts.back() : parameterize_defines(*cut, definitions, used));
+	}
+	selection.expression = combine_cuts(expanded_cuts);
+	selection.parameters.resize(definitions.size(), (TTreeFormula *)NULL);
+	selection.parameter_values.resize(definitions.size(), 0);
+	for(size_t d = 0; d < definitions.size(); d++)
+	{
+		if(used[d])
+		{
+			selection.parameters[d] = create_selection_formula(definitions[d].second, tree);
+			if(selection.parameters[d] == NULL)
+			{
+				return false;
+			}
+		}
+	}
+
+	//Create the combined formula
+	selection.formula = create_selection_formula(combine_cuts(formula_cuts), tree);
+	if(selection.formula == NULL)
+	{
+		return false;
+	}
+
+	//Create the weight formula
+	if(options.count("cutflow-weight") > 0)
+	{
+		selection.weight = create_selection_formula(options["cutflow-weight"].as<string>(), tree);
+		if(selection.weight == NULL)
+		{
+			return false;
+		}
+	}
+
+	//Create the stages, if we're short-circuiting.  A
+	//single cut gains nothing from being staged, unless we
+	//are counting it.
+	if(!short_circuit || (cuts.size() < 2 && !cutflow))
+	{
+		return true;
+	}
+	for(size_t c = 0; c < cuts.size(); c++)
+	{
+		SelectionStage stage;
+		stage.expression = cuts[c];
+		stage.formula = create_selection_formula(formula_cuts[c], tree);
+		stage.compiled = NULL;
+		stage.evaluated = 0;
+		stage.passed = 0;
+		stage.weighted_passed = 0;
+		stage.timed = 0;
+		stage.time = 0;
+		if(stage.formula == NULL)
+		{
+			return false;
+		}
+		selection.stages.push_back(stage);
+	}
+
+	return true;
+}
+
+void compile_selection_from_options(po::variables_map options, TTree *tree, Selection &selection)
+{
+	//Determine operating parameters.  Batching implies
+	//compilation.
+	Long64_t batch_size = 0;
+	if(options.count("batch-size") > 0)
+	{
+		batch_size = options["batch-size"].as<Long64_t>();
+	}
+	if((options.count("compile-selection") == 0 && batch_size <= 0)
+	   || selection.expression == TRIVIAL_SELECTION)
+	{
+		return;
+	}
+
+	//Compile either the combined formula, which can be
+	//evaluated in batches, or each stage, which can't since
+	//the point of a stage is to stop early
+	vector<string> leaf_names;
+	CompiledBatchFunction batch_function = NULL;
+	if(selection.stages.empty())
+	{
+		CompiledSelectionFunction function = compile_selection(options, selection.formula, leaf_names, batch_function);
+		if(function != NULL)
+		{
+			selection.compiled = new CompiledSelection(function, batch_function, leaf_names, tree, batch_size);
+		}
+		return;
+	}
+	vector<SelectionStage>::iterator stage;
+	for(stage = selection.stages.begin();
+		stage != selection.stages.end();
+		stage++)
+	{
+		CompiledSelectionFunction function = compile_selection(options, stage->formula, leaf_names, batch_function);
+		if(function != NULL)
+		{
+			stage->compiled = new CompiledSelection(function, NULL, leaf_names, tree, 0);
+		}
+	}
+}
+
+bool bind_selection(po::variables_map options,
+					const Selection &prototype,
+					TTree *tree,
+					Selection &selection)
+{
+	//Create the same selection on another tree.  The
+	//compiled code is shared, only the leaves it reads are
+	//per-tree.
+	if(!create_selection(options, prototype.cuts, tree, selection))
+	{
+		return false;
+	}
+	if(prototype.compiled != NULL)
+	{
+		selection.compiled = prototype.compiled->Bind(tree);
+	}
+	for(size_t i = 0; i < selection.stages.size(); i++)
+	{
+		if(prototype.stages[i].compiled != NULL)
+		{
+			selection.stages[i].compiled = prototype.stages[i].compiled->Bind(tree);
+		}
+	}
+	return true;
+}
+
+void add_selection_to_notifier(Selection &selection, ChainNotifier &notifier)
+{
+	notifier.Add(selection.formula);
+	if(selection.weight != NULL)
+	{
+		notifier.Add(selection.weight);
+	}
+	vector<TTreeFormula *>::iterator parameter;
+	for(parameter = selection.parameters.begin();
+		parameter != selection.parameters.end();
+		parameter++)
+	{
+		if(*parameter != NULL)
+		{
+			notifier.Add(*parameter);
+		}
+	}
+	if(selection.compiled != NULL)
+	{
+		notifier.Add(selection.compiled);
+	}
+	vector<SelectionStage>::iterator stage;
+	for(stage = selection.stages.begin();
+		stage != selection.stages.end();
+		stage++)
+	{
+		notifier.Add(stage->formula);
+		if(stage->compiled != NULL)
+		{
+			notifier.Add(stage->compiled);
+		}
+	}
+}
+
+bool compare_stage_cost(const SelectionStage &a, const SelectionStage &b)
+{
+	//Rank stages by their cost per rejected entry.  The
+	//cost is the measured time to evaluate a stage, which
+	//includes reading and decompressing any branches it is
+	//the first to need.  Stages which reject nothing go
+	//last.
+	Double_t a_rejection = a.evaluated > 0 ? 1.0 - (Double_t)a.passed / a.evaluated : 0;
+	Double_t b_rejection = b.evaluated > 0 ? 1.0 - (Double_t)b.passed / b.evaluated : 0;
+	if(a_rejection <= 0 || b_rejection <= 0)
+	{
+		return a_rejection > b_rejection;
+	}
+	Double_t a_cost = a.timed > 0 ? a.time / a.timed : 0;
+	Double_t b_cost = b.timed > 0 ? b.time / b.timed : 0;
+	return a_cost / a_rejection < b_cost / b_rejection;
+}
+
+void reorder_stages(Selection &selection)
+{
+	stable_sort(selection.stages.begin(), selection.stages.end(), compare_stage_cost);
+	if(selection.verbose)
+	{
+		cout << "Cut order after " << selection.evaluations << " entries:" << endl;
+		vector<SelectionStage>::iterator stage;
+		for(stage = selection.stages.begin();
+			stage != selection.stages.end();
+			stage++)
+		{
+			cout << "\t" << stage->expression << " (" << stage->passed << "/" << stage->evaluated << " passed)" << endl;
+		}
+	}
+}
+
+bool evaluate_stages(Selection &selection, Long64_t local_entry)
+{
+	//When reordering, time a sample of the evaluations
+	bool timed = (selection.reorder && (selection.evaluations & STAGE_TIMING_MASK) == 0);
+	selection.evaluations++;
+	Double_t weight = 1;
+	if(selection.weight != NULL)
+	{
+		weight = selection.weight->EvalInstance(0);
+		selection.weighted_evaluations += weight;
+	}
+
+	//Evaluate each stage until one fails
+	bool passed = true;
+	for(size_t i = 0; i < selection.stages.size() && passed; i++)
+	{
+		SelectionStage &stage = selection.stages[i];
+		Double_t start = timed ? TTimeStamp().AsDouble() : 0;
+		passed = is_selected(stage.formula, stage.compiled, local_entry);
+		if(timed)
+		{
+			stage.time += TTimeStamp().AsDouble() - start;
+			stage.timed++;
+		}
+		stage.evaluated++;
+		if(passed)
+		{
+			stage.passed++;
+			stage.weighted_passed += weight;
+		}
+	}
+
+	//Reorder the stages every so often
+	if(selection.reorder && selection.evaluations == selection.next_reorder)
+	{
+		reorder_stages(selection);
+		selection.next_reorder += STAGE_REORDER_INTERVAL;
+	}
+
+	return passed;
+}
+
+void get_selection_branches(Selection &selection, set<string> &branches)
+{
+	//The combined formula covers all of the stages
+	get_formula_branches(selection.formula, branches);
+	if(selection.weight != NULL)
+	{
+		get_formula_branches(selection.weight, branches);
+	}
+	vector<TTreeFormula *>::iterator parameter;
+	for(parameter = selection.parameters.begin();
+		parameter != selection.parameters.end();
+		parameter++)
+	{
+		if(*parameter != NULL)
+		{
+			get_formula_branches(*parameter, branches);
+		}
+	}
+}
+
+void merge_selection_counts(Selection &selection, const Selection &other)
+{
+	//Stages are only reordered when not making a cutflow,
+	//in which case the counts don't matter
+	selection.evaluations += other.evaluations;
+	selection.weighted_evaluations += other.weighted_evaluations;
+	for(size_t i = 0; i < selection.stages.size() && i < other.stages.size(); i++)
+	{
+		selection.stages[i].evaluated += other.stages[i].evaluated;
+		selection.stages[i].passed += other.stages[i].passed;
+		selection.stages[i].weighted_passed += other.stages[i].weighted_passed;
+	}
+}
+
+bool write_cutflow(Selection &selection, TFile *file, string output)
+{
+	//Create the histograms.  The first bin holds all
+	//entries, the others the entries passing each cut and
+	//all of those before it.
+	file->cd();
+	Int_t n_bins = selection.stages.size() + 1;
+	TH1D *cutflow = new TH1D("cutflow", "Cutflow", n_bins, 0, n_bins);
+	TH1D *weighted = NULL;
+	if(selection.weight != NULL)
+	{
+		weighted = new TH1D("cutflow_weighted", "Weighted cutflow", n_bins, 0, n_bins);
+	}
+	cutflow->GetXaxis()->SetBinLabel(1, "All");
+	cutflow->SetBinContent(1, selection.evaluations);
+	if(weighted != NULL)
+	{
+		weighted->GetXaxis()->SetBinLabel(1, "All");
+		weighted->SetBinContent(1, selection.weighted_evaluations);
+	}
+	for(size_t i = 0; i < selection.stages.size(); i++)
+	{
+		SelectionStage &stage = selection.stages[i];
+		cutflow->GetXaxis()->SetBinLabel(i + 2, stage.expression.c_str());
+		cutflow->SetBinContent(i + 2, stage.passed);
+		if(weighted != NULL)
+		{
+			weighted->GetXaxis()->SetBinLabel(i + 2, stage.expression.c_str());
+			weighted->SetBinContent(i + 2, stage.weighted_passed);
+		}
+	}
+
+	//Write the text summary
+	string summary_path = output + ".cutflow.txt";
+	ofstream summary(summary_path.c_str());
+	if(!summary.is_open())
+	{
+		cerr << "ERROR: Unable to open the cutflow summary (" << summary_path << ") for writing." << endl;
+		return false;
+	}
+	summary << "#cut	passed";
+	if(weighted != NULL)
+	{
+		summary << "	weighted";
+	}
+	summary << endl;
+	summary << "All	" << selection.evaluations;
+	if(weighted != NULL)
+	{
+		summary << "	" << selection.weighted_evaluations;
+	}
+	summary << endl;
+	for(size_t i = 0; i < selection.stages.size(); i++)
+	{
+		SelectionStage &stage = selection.stages[i];
+		summary << stage.expression << "	" << stage.passed;
+		if(weighted != NULL)
+		{
+			summary << "	" << stage.weighted_passed;
+		}
+		summary << endl;
+	}
+	summary.close();
+	if(selection.verbose)
+	{
+		cout << "Cutflow for " << output << " written to " << summary_path << endl;
+	}
+
+	return true;
+}
+
+void set_selection_end(Selection &selection, Long64_t end_entry)
+{
+	//Only the whole selection is evaluated in batches
+	if(selection.compiled != NULL)
+	{
+		selection.compiled->SetEndEntry(end_entry);
+	}
+}
+
+inline void evaluate_parameters(Selection &selection)
+{
+	//Compute the definitions the cuts use, and pass them in
+	for(size_t d = 0; d < selection.parameters.size(); d++)
+	{
+		if(selection.parameters[d] == NULL)
+		{
+			continue;
+		}
+		Double_t value = selection.parameters[d]->EvalInstance(0);
+		selection.parameter_values[d] = value;
+		selection.formula->SetParameter(d, value);
+		vector<SelectionStage>::iterator stage;
+		for(stage = selection.stages.begin();
+			stage != selection.stages.end();
+			stage++)
+		{
+			stage->formula->SetParameter(d, value);
+		}
+	}
+}
+
+inline bool evaluate_selection(Selection &selection, Long64_t local_entry)
+{
+	evaluate_parameters(selection);
+	if(selection.stages.empty() && !selection.cutflow)
+	{
+		return is_selected(selection.formula, selection.compiled, local_entry);
+	}
+	return evaluate_stages(selection, local_entry);
+}
+
+bool create_defines_from_options(po::variables_map options,
+								 TChain *chain,
+								 vector<Define> &defines)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	bool compile = (options.count("compile-selection") > 0);
+	vector< pair<string, string> > definitions;
+	if(!get_defines_from_options(options, definitions))
+	{
+		return false;
+	}
+
+	//Size the list up front, since the output branches
+	//point into it
+	defines.resize(definitions.size());
+	for(size_t d = 0; d < definitions.size(); d++)
+	{
+		Define &define = defines[d];
+		define.name = definitions[d].first;
+		define.expression = definitions[d].second;
+		define.formula = NULL;
+		define.compiled = NULL;
+		define.value = 0;
+		if(verbose)
+		{
+			cout << "Defining " << define.name << " = " << define.expression << endl;
+		}
+		if(chain->GetBranch(define.name.c_str()) != NULL)
+		{
+			cerr << "ERROR: Definition " << define.name << " has the same name as an input branch." << endl;
+			return false;
+		}
+		define.formula = create_selection_formula(define.expression, chain);
+		if(define.formula == NULL)
+		{
+			return false;
+		}
+		if(compile)
+		{
+			vector<string> leaf_names;
+			CompiledBatchFunction batch_function = NULL;
+			CompiledSelectionFunction function = compile_selection(options, define.formula, leaf_names, batch_function);
+			if(function != NULL)
+			{
+				define.compiled = new CompiledSelection(function, NULL, leaf_names, chain, 0);
+			}
+		}
+	}
+
+	return true;
+}
+
+void add_define_branches(vector<Define> &defines, TTree *tree)
+{
+	vector<Define>::iterator define;
+	for(define = defines.begin();
+		define != defines.end();
+		define++)
+	{
+		string leaf_list = define->name + "/D";
+		tree->Branch(define->name.c_str(), &define->value, leaf_list.c_str());
+	}
+}
+
+void add_defines_to_notifier(vector<Define> &defines, ChainNotifier &notifier)
+{
+	vector<Define>::iterator define;
+	for(define = defines.begin();
+		define != defines.end();
+		define++)
+	{
+		notifier.Add(define->formula);
+		if(define->compiled != NULL)
+		{
+			notifier.Add(define->compiled);
+		}
+	}
+}
+
+void get_define_branches(vector<Define> &defines, set<string> &branches)
+{
+	vector<Define>::iterator define;
+	for(define = defines.begin();
+		define != defines.end();
+		define++)
+	{
+		get_formula_branches(define->formula, branches);
+	}
+}
+
+//An output file, with its own selection and branch set,
+//which is filled from the input tree
+struct OutputStream
+{
+	po::variables_map options;
+	string output;
+	Selection selection;
+	TFile *file;
+	TTree *tree;
+	set<string> enabled_branches;
+	int output_events;
+	bool selected;
+	bool finished;
+};
+
+void init_output_stream(OutputStream &stream)
+{
+	init_selection(stream.selection);
+	stream.file = NULL;
+	stream.tree = NULL;
+	stream.output_events = 0;
+	stream.selected = false;
+	stream.finished = false;
+}
+
+bool open_output_stream(po::variables_map options, TChain *old_tree, vector<Define> &defines, OutputStream &stream)
+{
+	//Determine operating parameters
+	bool replace = (options.count("replace") > 0);
+
+	init_output_stream(stream);
+
+	//Create the output file
+	string output_options = replace ? "RECREATE" : "CREATE";
+	stream.file = TFile::Open(stream.output.c_str(), output_options.c_str());
+	if(stream.file == NULL)
+	{
+		//Unable to open the file
+		cerr << "ERROR: Unable to open the output file (" << stream.output << ") for writing." << endl;
+		return false;
+	}
+	stream.file->cd();
+
+	//Set branch status so we know what to read/include in the new file
+	set_branches_from_options(stream.options, old_tree);
+	get_enabled_branches(old_tree, stream.enabled_branches);
+	
+	//Clone the tree (but don't copy any entries yet).
+	//We are implicitly within the context of the new
+	//file (this is just how ROOT operates), so this
+	//new tree will automatically be added to that 
+	//file.  If only an index of the selected entries is
+	//being written, the data stays where it is.
+	if(options.count("entry-list-output") > 0)
+	{
+		stream.tree = new TTree(ENTRY_INDEX_TREE_NAME.c_str(), "Index of the selected entries");
+	}
+	else
+	{
+		stream.tree = old_tree->CloneTree(0);
+	}
+
+	//Add the definitions, before the layout is chosen so
+	//that they get the same treatment as every other branch
+	add_define_branches(defines, stream.tree);
+
+	//Set the output compression and basket layout
+	if(!set_compression_from_options(options, stream.file, stream.tree)
+	   || !set_basket_layout_from_options(options, stream.tree))
+	{
+		return false;
+	}
+
+	//Create the selection
+	vector<string> cuts;
+	if(!get_selection_cuts_from_options(stream.options, cuts)
+	   || !create_selection(options, cuts, old_tree, stream.selection))
+	{
+		//Unable to compile selection formula
+		cerr << "ERROR: Unable to create selection formula." << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool close_output_stream(OutputStream &stream, bool write)
+{
+	//Save the output file (required for data
+	//to be written) and close.  No need to delete
+	//the new tree (or cutflow), it is owned by the
+	//file.
+	bool success = true;
+	if(stream.file != NULL)
+	{
+		if(write)
+		{
+			if(stream.selection.cutflow)
+			{
+				success = write_cutflow(stream.selection, stream.file, stream.output);
+			}
+			stream.file->Write();
+		}
+		stream.file->Close();
+
+		//An output which wasn't written is incomplete, so
+		//don't leave it behind
+		if(!write)
+		{
+			gSystem->Unlink(stream.output.c_str());
+		}
+	}
+	delete_selection(stream.selection);
+	delete stream.file;
+	stream.file = NULL;
+	stream.tree = NULL;
+
+	return success;
+}
+
+bool close_output_streams(vector<OutputStream> &streams, bool write)
+{
+	bool success = true;
+	vector<OutputStream>::iterator stream;
+	for(stream = streams.begin();
+		stream != streams.end();
+		stream++)
+	{
+		success = close_output_stream(*stream, write) && success;
+	}
+	return success;
+}
+
+inline void evaluate_defines(vector<Define> &defines, const vector<OutputStream> &streams, Long64_t local_entry)
+{
+	for(size_t d = 0; d < defines.size(); d++)
+	{
+		//Reuse the value if a selection has already computed
+		//it for this entry
+		Define &define = defines[d];
+		bool computed = false;
+		for(size_t s = 0; s < streams.size() && !computed; s++)
+		{
+			const Selection &selection = streams[s].selection;
+			if(!streams[s].finished && d < selection.parameters.size() && selection.parameters[d] != NULL)
+			{
+				define.value = selection.parameter_values[d];
+				computed = true;
+			}
+		}
+		if(computed)
+		{
+			continue;
+		}
+		if(define.compiled != NULL)
+		{
+			define.value = define.compiled->Evaluate(define.formula, local_entry);
+		}
+		else
+		{
+			define.value = define.formula->EvalInstance(0);
+		}
+	}
+}
+
+void delete_defines(vector<Define> &defines)
+{
+	vector<Define>::iterator define;
+	for(define = defines.begin();
+		define != defines.end();
+		define++)
+	{
+		delete define->compiled;
+		delete define->formula;
+	}
+	defines.clear();
+}
+
+//Counters for a single input file of the chain
+struct FileStatistics
+{
+	Int_t tree_number;
+	string name;
+	Long64_t input_events;
+	Long64_t selected_events;
+	Long64_t bytes_read;
+	Int_t read_calls;
+	Double_t cache_efficiency;
+	Double_t real_time;
+};
+
+//Counters for a branch read from the input, summed over
+//the files visited
+struct BranchStatistics
+{
+	Long64_t zip_bytes;
+	Long64_t tot_bytes;
+};
+
+//Timing and I/O counters for a whole run.  The per-call
+//timers and per-file counters are only kept by the
+//single-pass entry loop.
+struct SkimStatistics
+{
+	bool enabled;
+	TStopwatch total_timer;
+	TStopwatch select_timer;
+	TStopwatch read_timer;
+	TStopwatch fill_timer;
+	TStopwatch file_timer;
+	TTreePerfStats *perf_stats;
+	Long64_t input_events;
+	Long64_t selected_events;
+	Long64_t output_events;
+	Long64_t file_end;
+	Long64_t file_bytes_read;
+	Int_t file_read_calls;
+	set<string> read_branches;
+	vector<FileStatistics> files;
+	map<string, BranchStatistics> branches;
+};
+
+void start_statistics(po::variables_map options,
+					  TChain *chain,
+					  const set<string> &read_branches,
+					  SkimStatistics &stats)
+{
+	stats.enabled = (options.count("stats") > 0 || options.count("stats-json") > 0);
+	stats.perf_stats = NULL;
+	stats.input_events = 0;
+	stats.selected_events = 0;
+	stats.output_events = 0;
+	stats.file_end = 0;
+	stats.file_bytes_read = 0;
+	stats.file_read_calls = 0;
+	if(!stats.enabled)
+	{
+		return;
+	}
+
+	stats.read_branches = read_branches;
+	stats.select_timer.Reset();
+	stats.read_timer.Reset();
+	stats.fill_timer.Reset();
+	stats.total_timer.Start();
+}
+
+void attach_perf_stats(TChain *chain, SkimStatistics &stats)
+{
+	//TTreePerfStats needs a file to be loaded.
+	//Note that it registers itself as the global
+	//gPerfStats, which every TFile reports to, so it
+	//mustn't be attached while other threads are reading.
+	if(!stats.enabled || stats.perf_stats != NULL)
+	{
+		return;
+	}
+	chain->LoadTree(0);
+	stats.perf_stats = new TTreePerfStats("ioperf", chain);
+}
+
+void finish_file_statistics(TChain *chain, SkimStatistics &stats)
+{
+	//Nothing to do before the first file
+	if(stats.file_end == 0 || stats.files.empty())
+	{
+		return;
+	}
+
+	//Everything is measured relative to the start of
+	//the file, the entry counts were kept as we went
+	FileStatistics &file = stats.files.back();
+	file.bytes_read = TFile::GetFileBytesRead() - stats.file_bytes_read;
+	file.read_calls = TFile::GetFileReadCalls() - stats.file_read_calls;
+	file.real_time = stats.file_timer.RealTime();
+	file.cache_efficiency = -1;
+	TFile *current_file = chain->GetCurrentFile();
+	if(current_file != NULL)
+	{
+		TTreeCache *cache = chain->GetTree()->GetReadCache(current_file);
+		if(cache != NULL)
+		{
+			file.cache_efficiency = cache->GetEfficiency();
+		}
+	}
+}
+
+bool start_file_statistics(TChain *chain, Long64_t entry, SkimStatistics &stats)
+{
+	//Ask the chain which file the entry is in, since files
+	//before it may have been skipped (by the entry range,
+	//the cluster index or the selection)
+	if(chain->LoadTree(entry) < 0)
+	{
+		stats.file_end = chain->GetEntries();
+		return false;
+	}
+	Int_t tree_number = chain->GetTreeNumber();
+	stats.file_end = chain->GetTreeOffset()[tree_number + 1];
+
+	FileStatistics file;
+	file.tree_number = tree_number;
+	file.name = chain->GetListOfFiles()->At(tree_number)->GetTitle();
+	file.input_events = 0;
+	file.selected_events = 0;
+	file.bytes_read = 0;
+	file.read_calls = 0;
+	file.cache_efficiency = -1;
+	file.real_time = 0;
+	stats.files.push_back(file);
+	stats.file_bytes_read = TFile::GetFileBytesRead();
+	stats.file_read_calls = TFile::GetFileReadCalls();
+	stats.file_timer.Start();
+	return true;
+}
+
+void record_branch_statistics(TChain *chain, SkimStatistics &stats)
+{
+	//Sum the size of each branch read in the current file
+	set<string>::iterator name;
+	for(name = stats.read_branches.begin();
+		name != stats.read_branches.end();
+		name++)
+	{
+		TBranch *branch = chain->GetTree()->GetBranch(name->c_str());
+		if(branch == NULL)
+		{
+			continue;
+		}
+		BranchStatistics &branch_stats = stats.branches[*name];
+		branch_stats.zip_bytes += branch->GetZipBytes("*");
+		branch_stats.tot_bytes += branch->GetTotBytes("*");
+	}
+}
+
+inline void update_file_statistics(TChain *chain, Long64_t entry, SkimStatistics &stats)
+{
+	//This is called for every entry, before it is loaded,
+	//so it needs to be cheap when we're not crossing into
+	//a new file
+	if(entry < stats.file_end)
+	{
+		return;
+	}
+	finish_file_statistics(chain, stats);
+	if(start_file_statistics(chain, entry, stats))
+	{
+		record_branch_statistics(chain, stats);
+	}
+}
+
+void finish_statistics(TChain *chain, SkimStatistics &stats)
+{
+	if(!stats.enabled)
+	{
+		return;
+	}
+	finish_file_statistics(chain, stats);
+	stats.total_timer.Stop();
+	attach_perf_stats(chain, stats);
+	stats.perf_stats->Finish();
+	chain->SetPerfStats(NULL);
+}
+
+string json_escape(string value)
+{
+	string result;
+	for(size_t i = 0; i < value.length(); i++)
+	{
+		char c = value[i];
+		if(c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+			result += escaped;
+		}
+		else
+		{
+			result += c;
+		}
+	}
+	return result;
+}
+
+void print_statistics(SkimStatistics &stats, ostream &out)
+{
+	Double_t real_time = stats.total_timer.RealTime();
+	Double_t rate = real_time > 0 ? stats.input_events / real_time : 0;
+
+	out << "Statistics:" << endl;
+	out << "\tInput events: " << stats.input_events << endl;
+	out << "\tSelected events: " << stats.selected_events << endl;
+	out << "\tOutput events: " << stats.output_events << endl;
+	out << "\tReal time (s): " << real_time << endl;
+	out << "\tCPU time (s): " << stats.total_timer.CpuTime() << endl;
+	out << "\tInput events/s: " << rate << endl;
+	out << "\tBytes read: " << stats.perf_stats->GetBytesRead() << endl;
+	out << "\tRead calls: " << stats.perf_stats->GetReadCalls() << endl;
+	out << "\tDisk time (s): " << stats.perf_stats->GetDiskTime() << endl;
+	out << "\tUnzip time (s): " << stats.perf_stats->GetUnzipTime() << endl;
+	out << "\tSelection time (s): " << stats.select_timer.RealTime() << endl;
+	out << "\tGetEntry time (s): " << stats.read_timer.RealTime() << endl;
+	out << "\tFill time (s): " << stats.fill_timer.RealTime() << endl;
+
+	if(!stats.files.empty())
+	{
+		out << "\tFiles:" << endl;
+		vector<FileStatistics>::iterator file;
+		for(file = stats.files.begin();
+			file != stats.files.end();
+			file++)
+		{
+			out << "\t\t" << file->name << ": "
+				<< file->input_events << " input, "
+				<< file->selected_events << " selected, "
+				<< file->bytes_read << " bytes read in "
+				<< file->read_calls << " calls, "
+				<< file->real_time << " s";
+			if(file->cache_efficiency >= 0)
+			{
+				out << ", cache efficiency " << file->cache_efficiency;
+			}
+			out << endl;
+		}
+	}
+
+	if(!stats.branches.empty())
+	{
+		out << "\tBranches (compressed/uncompressed bytes in the files visited):" << endl;
+		map<string, BranchStatistics>::iterator branch;
+		for(branch = stats.branches.begin();
+			branch != stats.branches.end();
+			branch++)
+		{
+			out << "\t\t" << branch->first << ": "
+				<< branch->second.zip_bytes << "/"
+				<< branch->second.tot_bytes << endl;
+		}
+	}
+}
+
+bool write_statistics_json(SkimStatistics &stats, string path)
+{
+	ofstream out(path.c_str());
+	if(!out.is_open())
+	{
+		cerr << "ERROR: Unable to open the statistics file (" << path << ") for writing." << endl;
+		return false;
+	}
+
+	Double_t real_time = stats.total_timer.RealTime();
+	out << "{" << endl;
+	out << "  \"input_events\": " << stats.input_events << "," << endl;
+	out << "  \"selected_events\": " << stats.selected_events << "," << endl;
+	out << "  \"output_events\": " << stats.output_events << "," << endl;
+	out << "  \"real_time\": " << real_time << "," << endl;
+	out << "  \"cpu_time\": " << stats.total_timer.CpuTime() << "," << endl;
+	out << "  \"events_per_second\": " << (real_time > 0 ? stats.input_events / real_time : 0) << "," << endl;
+	out << "  \"bytes_read\": " << stats.perf_stats->GetBytesRead() << "," << endl;
+	out << "  \"read_calls\": " << stats.perf_stats->GetReadCalls() << "," << endl;
+	out << "  \"disk_time\": " << stats.perf_stats->GetDiskTime() << "," << endl;
+	out << "  \"unzip_time\": " << stats.perf_stats->GetUnzipTime() << "," << endl;
+	out << "  \"select_time\": " << stats.select_timer.RealTime() << "," << endl;
+	out << "  \"get_entry_time\": " << stats.read_timer.RealTime() << "," << endl;
+	out << "  \"fill_time\": " << stats.fill_timer.RealTime() << "," << endl;
+
+	out << "  \"files\": [";
+	for(size_t i = 0; i < stats.files.size(); i++)
+	{
+		FileStatistics &file = stats.files[i];
+		out << (i > 0 ? "," : "") << endl;
+		out << "    {\"tree_number\": " << file.tree_number << ", "
+			<< "\"name\": \"" << json_escape(file.name) << "\", "
+			<< "\"input_events\": " << file.input_events << ", "
+			<< "\"selected_events\": " << file.selected_events << ", "
+			<< "\"bytes_read\": " << file.bytes_read << ", "
+			<< "\"read_calls\": " << file.read_calls << ", "
+			<< "\"cache_efficiency\": " << file.cache_efficiency << ", "
+			<< "\"real_time\": " << file.real_time << "}";
+	}
+	out << endl << "  ]," << endl;
+
+	out << "  \"branches\": [";
+	map<string, BranchStatistics>::iterator branch;
+	for(branch = stats.branches.begin();
+		branch != stats.branches.end();
+		branch++)
+	{
+		out << (branch != stats.branches.begin() ? "," : "") << endl;
+		out << "    {\"name\": \"" << json_escape(branch->first) << "\", "
+			<< "\"zip_bytes\": " << branch->second.zip_bytes << ", "
+			<< "\"tot_bytes\": " << branch->second.tot_bytes << "}";
+	}
+	out << endl << "  ]" << endl;
+	out << "}" << endl;
+
+	return true;
+}
+
+bool report_statistics(po::variables_map options, SkimStatistics &stats)
+{
+	if(!stats.enabled)
+	{
+		return true;
+	}
+	if(options.count("stats") > 0)
+	{
+		print_statistics(stats, cout);
+	}
+	bool success = true;
+	if(options.count("stats-json") > 0)
+	{
+		success = write_statistics_json(stats, options["stats-json"].as<string>());
+	}
+	delete stats.perf_stats;
+	stats.perf_stats = NULL;
+	return success;
+}
+
+//Periodic progress output for a loop over entries
+struct ProgressReporter
+{
+	bool enabled;
+	string label;
+	Double_t interval;
+	Double_t start_time;
+	Double_t next_time;
+	Long64_t total;
+	Long64_t start_bytes;
+};
+
+void start_progress(po::variables_map options, string label, Long64_t total, ProgressReporter &progress)
+{
+	progress.enabled = (options.count("progress") > 0);
+	progress.label = label;
+	progress.total = total;
+	if(!progress.enabled)
+	{
+		return;
+	}
+	progress.interval = options["progress"].as<double>();
+	progress.start_time = TTimeStamp().AsDouble();
+	progress.next_time = progress.start_time + progress.interval;
+	progress.start_bytes = TFile::GetFileBytesRead();
+}
+
+void print_progress(ProgressReporter &progress, Long64_t done, Long64_t selected, Double_t now)
+{
+	//A negative selected count means it isn't meaningful
+	//for this loop
+	Double_t elapsed = now - progress.start_time;
+	Double_t rate = elapsed > 0 ? done / elapsed : 0;
+	Double_t megabytes = (TFile::GetFileBytesRead() - progress.start_bytes) / 1e6;
+
+	cerr << progress.label << ": " << done << "/" << progress.total << " entries";
+	if(progress.total > 0)
+	{
+		cerr << " (" << (100.0 * done) / progress.total << "%)";
+	}
+	if(done > 0 && selected >= 0)
+	{
+		cerr << ", " << (100.0 * selected) / done << "% selected";
+	}
+	if(elapsed > 0)
+	{
+		cerr << ", " << megabytes / elapsed << " MB/s";
+	}
+	if(rate > 0 && done < progress.total)
+	{
+		Long64_t eta = (Long64_t)((progress.total - done) / rate);
+		cerr << ", ETA " << eta / 3600 << "h" << (eta / 60) % 60 << "m" << eta % 60 << "s";
+	}
+	cerr << endl;
+}
+
+inline void update_progress(ProgressReporter &progress, Long64_t done, Long64_t selected)
+{
+	//Only look at the clock every so often, so this costs
+	//next to nothing per entry
+	if(!progress.enabled || (done & PROGRESS_CHECK_MASK) != 0)
+	{
+		return;
+	}
+	Double_t now = TTimeStamp().AsDouble();
+	if(now >= progress.next_time)
+	{
+		print_progress(progress, done, selected, now);
+		progress.next_time = now + progress.interval;
+	}
+}
+
+void finish_progress(ProgressReporter &progress, Long64_t done, Long64_t selected)
+{
+	if(progress.enabled)
+	{
+		print_progress(progress, done, selected, TTimeStamp().AsDouble());
+	}
+}
+
+//Resident memory of the process, checked against the
+//--max-memory ceiling, and the peak usage of the parts of
+//it which skimslim controls.  Selection threads share it,
+//and all stop once one of them finds the ceiling exceeded.
+struct MemoryMonitor
+{
+	bool enabled;
+	Long64_t limit;
+	Long64_t peak_resident;
+	Long64_t peak_cache;
+	Long64_t peak_output;
+	Long64_t flushes;
+	bool exceeded;
+	boost::mutex mutex;
+};
+
+void start_memory_monitor(po::variables_map options, MemoryMonitor &monitor)
+{
+	monitor.enabled = (options.count("max-memory") > 0);
+	monitor.limit = monitor.enabled ? options["max-memory"].as<Long64_t>() : -1;
+	monitor.peak_resident = 0;
+	monitor.peak_cache = 0;
+	monitor.peak_output = 0;
+	monitor.flushes = 0;
+	monitor.exceeded = false;
+}
+
+Long64_t get_resident_memory()
+{
+	//ROOT reports the resident size in kB
+	ProcInfo_t info;
+	if(gSystem->GetProcInfo(&info) != 0)
+	{
+		return 0;
+	}
+	return (Long64_t)info.fMemResident * 1024;
+}
+
+void print_memory_report(MemoryMonitor &monitor, ostream &out)
+{
+	out << "Peak memory (MB):" << endl;
+	out << "\tResident: " << monitor.peak_resident / 1e6 << " (limit " << monitor.limit / 1e6 << ")" << endl;
+	out << "\tInput cache: " << monitor.peak_cache / 1e6 << endl;
+	out << "\tOutput baskets: " << monitor.peak_output / 1e6 << endl;
+	out << "\tOther (formulas, files, dictionaries): "
+		<< max(monitor.peak_resident - monitor.peak_cache - monitor.peak_output, (Long64_t)0) / 1e6 << endl;
+	if(monitor.flushes > 0)
+	{
+		out << "\tEarly output flushes: " << monitor.flushes << endl;
+	}
+}
+
+bool check_memory(MemoryMonitor &monitor, TTree *input, const vector<TTree *> &outputs)
+{
+	boost::mutex::scoped_lock lock(monitor.mutex);
+	if(monitor.exceeded)
+	{
+		return false;
+	}
+
+	//Record the size of each component
+	Long64_t output_memory = 0;
+	vector<TTree *>::const_iterator output;
+	for(output = outputs.begin();
+		output != outputs.end();
+		output++)
+	{
+		output_memory += get_buffered_memory((*output)->GetListOfBranches());
+	}
+	monitor.peak_cache = max(monitor.peak_cache, input->GetCacheSize());
+	monitor.peak_output = max(monitor.peak_output, output_memory);
+	Long64_t resident = get_resident_memory();
+	monitor.peak_resident = max(monitor.peak_resident, resident);
+	if(resident <= monitor.limit)
+	{
+		return true;
+	}
+
+	//Write out the buffered baskets and look again, then
+	//give up before the batch system kills us
+	for(output = outputs.begin();
+		output != outputs.end();
+		output++)
+	{
+		(*output)->FlushBaskets();
+	}
+	monitor.flushes++;
+	resident = get_resident_memory();
+	if(resident <= monitor.limit)
+	{
+		return true;
+	}
+	cerr << "ERROR: Resident memory (" << resident / 1e6 << " MB) exceeds --max-memory ("
+		 << monitor.limit / 1e6 << " MB), stopping" << endl;
+	print_memory_report(monitor, cerr);
+	monitor.exceeded = true;
+	return false;
+}
+
+inline bool update_memory(MemoryMonitor &monitor, TTree *input, const vector<TTree *> &outputs, Long64_t done)
+{
+	//Like progress, memory is only looked at every so
+	//often
+	if(!monitor.enabled || (done & MEMORY_CHECK_MASK) != 0)
+	{
+		return true;
+	}
+	return check_memory(monitor, input, outputs);
+}
+
+Long64_t get_shard_boundary(const vector<Long64_t> &boundaries, Long64_t target, Long64_t end_entry)
+{
+	//Use the first cluster boundary at or after the target
+	vector<Long64_t>::const_iterator boundary = lower_bound(boundaries.begin(), boundaries.end(), target);
+	return (boundary == boundaries.end()) ? end_entry : *boundary;
+}
+
+bool get_entry_range_from_options(po::variables_map options,
+								  TChain *chain,
+								  Long64_t &first_entry,
+								  Long64_t &end_entry)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Start with everything, then apply the first entry and
+	//the maximum number of entries
+	first_entry = 0;
+	end_entry = chain->GetEntries();
+	if(options.count("first-event") > 0)
+	{
+		first_entry = options["first-event"].as<Long64_t>();
+		if(first_entry < 0 || first_entry >= end_entry)
+		{
+			cerr << "ERROR: First event must be >= 0 and less than the number of entries to make sense" << endl;
+			return false;
+		}
+	}
+	if(options.count("max-input-events") > 0)
+	{
+		end_entry = min(end_entry, first_entry + options["max-input-events"].as<int>());
+	}
+
+	//Take this job's share of that range
+	if(options.count("shard") > 0)
+	{
+		string shard = options["shard"].as<string>();
+		istringstream shard_stream(shard);
+		Long64_t shard_index = -1;
+		Long64_t n_shards = 0;
+		char separator = 0;
+		shard_stream >> shard_index >> separator >> n_shards;
+		if(shard_stream.fail() || !shard_stream.eof() || separator != '/'
+		   || n_shards <= 0 || shard_index < 0 || shard_index >= n_shards)
+		{
+			cerr << "ERROR: Shard must be given as K/N with 0 <= K < N: " << shard << endl;
+			return false;
+		}
+
+		//Find the cluster boundaries within the range.  Each
+		//job finds the same ones, and shards only split at
+		//them, so no basket is read by two jobs.
+		vector<Long64_t> boundaries;
+		Long64_t *offsets = chain->GetTreeOffset();
+		for(Int_t t = 0; t < chain->GetNtrees(); t++)
+		{
+			if(offsets[t + 1] <= first_entry || offsets[t] >= end_entry)
+			{
+				continue;
+			}
+			chain->LoadTree(offsets[t]);
+			TTree *tree = chain->GetTree();
+			Long64_t tree_entries = tree->GetEntries();
+			TTree::TClusterIterator cluster_iterator = tree->GetClusterIterator(0);
+			Long64_t cluster_entry;
+			while((cluster_entry = cluster_iterator()) < tree_entries)
+			{
+				Long64_t boundary = offsets[t] + cluster_entry;
+				if(boundary > first_entry && boundary < end_entry)
+				{
+					boundaries.push_back(boundary);
+				}
+			}
+		}
+
+		Long64_t range = end_entry - first_entry;
+		Long64_t shard_first = first_entry;
+		if(shard_index > 0)
+		{
+			shard_first = get_shard_boundary(boundaries, first_entry + range * shard_index / n_shards, end_entry);
+		}
+		if(shard_index < n_shards - 1)
+		{
+			end_entry = get_shard_boundary(boundaries, first_entry + range * (shard_index + 1) / n_shards, end_entry);
+		}
+		first_entry = shard_first;
+	}
+
+	if(verbose && (first_entry > 0 || end_entry < chain->GetEntries()))
+	{
+		cout << "Processing entries " << first_entry << " to " << end_entry << endl;
+	}
+
+	return true;
+}
+
+//A contiguous range of input entries whose selection
+//is evaluated by a single worker thread.  Each task
+//owns its own chain and formula, since neither is
+//safe to share between threads.
+struct SelectionTask
+{
+	TChain *chain;
+	Selection *selection;
+	ChainNotifier notifier;
+	FilePrefetcher *prefetcher;
+	Long64_t first_entry;
+	Long64_t last_entry;
+	vector<Long64_t> selected_entries;
+	const ClusterIndex *index;
+	ProgressReporter *progress;
+	MemoryMonitor *memory;
+	bool out_of_memory;
+	bool read_error;
+};
+
+void evaluate_selection_task(SelectionTask *task)
+{
+	set_selection_end(*task->selection, task->last_entry);
+	size_t cursor = 0;
+	const vector<TTree *> no_outputs;
+	task->out_of_memory = false;
+	task->read_error = false;
+	for(Long64_t i = task->first_entry; i < task->last_entry; i++)
+	{
+		i = skip_clusters(task->index, cursor, i);
+		if(i >= task->last_entry)
+		{
+			break;
+		}
+		if(task->progress != NULL)
+		{
+			update_progress(*task->progress, i - task->first_entry, task->selected_entries.size());
+		}
+		if(!update_memory(*task->memory, task->chain, no_outputs, i - task->first_entry))
+		{
+			task->out_of_memory = true;
+			break;
+		}
+
+		//An unreadable file would leave the output short
+		Long64_t local_entry = task->chain->LoadTree(i);
+		if(local_entry < 0)
+		{
+			cerr << "ERROR: Unable to read entry " << i << " of the input." << endl;
+			task->read_error = true;
+			break;
+		}
+
+		if(evaluate_selection(*task->selection, local_entry))
+		{
+			task->selected_entries.push_back(i);
+		}
+	}
+}
+
+bool select_entries(po::variables_map options,
+					TChain *chain,
+					Selection &selection,
+					Long64_t first_entry,
+					Long64_t end_entry,
+					const set<string> &copy_branches,
+					const ClusterIndex &index,
+					MemoryMonitor &memory,
+					vector<Long64_t> &selected_entries)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Read only the branches needed by the selection
+	set<string> selection_branches;
+	get_selection_branches(selection, selection_branches);
+	if(verbose)
+	{
+		cout << "Evaluating selection on " << selection_branches.size() << " branch(es)" << endl;
+	}
+	enable_only_branches(chain, selection_branches);
+	configure_cache_from_options(options, chain, selection_branches);
+
+	//Evaluate the selection over all entries
+	SelectionTask task;
+	task.chain = chain;
+	task.selection = &selection;
+	task.first_entry = first_entry;
+	task.last_entry = end_entry;
+	task.index = &index;
+	task.memory = &memory;
+	ProgressReporter progress;
+	start_progress(options, "Selection", end_entry - first_entry, progress);
+	task.progress = &progress;
+	evaluate_selection_task(&task);
+	finish_progress(progress, end_entry - first_entry, task.selected_entries.size());
+	selected_entries.swap(task.selected_entries);
+
+	//Restore the branch status for copying, and re-prime
+	//the cache for the copy pass
+	enable_only_branches(chain, copy_branches);
+	configure_cache_from_options(options, chain, copy_branches);
+
+	return !task.out_of_memory && !task.read_error;
+}
+
+bool select_entries_in_parallel(po::variables_map options,
+								Selection &selection,
+								Long64_t first_entry,
+								Long64_t end_entry,
+								int n_threads,
+								const ClusterIndex &index,
+								MemoryMonitor &memory,
+								vector<Long64_t> &selected_entries)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string container = options["container"].as<string>();
+
+	//Let ROOT know that it will be used from multiple
+	//threads
+	ROOT::EnableThreadSafety();
+
+	//Create the tasks.  The chains and formulas are set
+	//up here, serially, since TTreeFormula compilation
+	//goes through the interpreter.
+	vector<SelectionTask> tasks(n_threads);
+	Long64_t n_events = end_entry - first_entry;
+	Long64_t entries_per_task = (n_events + n_threads - 1) / n_threads;
+	bool success = true;
+	for(int t = 0; t < n_threads; t++)
+	{
+		SelectionTask &task = tasks[t];
+		task.first_entry = first_entry + min(n_events, t * entries_per_task);
+		task.last_entry = first_entry + min(n_events, (t + 1) * entries_per_task);
+		task.chain = new TChain(container.c_str());
+		task.selection = new Selection();
+		task.prefetcher = NULL;
+		task.index = &index;
+		task.progress = NULL;
+		task.memory = &memory;
+		task.out_of_memory = false;
+		task.read_error = false;
+		init_selection(*task.selection);
+		if(!add_inputs_from_options(options, task.chain)
+		   || !bind_selection(options, selection, task.chain, *task.selection))
+		{
+			success = false;
+			continue;
+		}
+		add_selection_to_notifier(*task.selection, task.notifier);
+		task.prefetcher = create_prefetcher_from_options(options, task.chain);
+		if(task.prefetcher != NULL)
+		{
+			task.notifier.Add(task.prefetcher);
+		}
+		task.chain->SetNotify(&task.notifier);
+
+		//Only the selection branches need to be read
+		set<string> selection_branches;
+		get_selection_branches(*task.selection, selection_branches);
+		enable_only_branches(task.chain, selection_branches);
+		configure_cache_from_options(options, task.chain, selection_branches);
+
+		if(verbose)
+		{
+			cout << "Thread " << t << " evaluating entries " << task.first_entry
+				 << " to " << task.last_entry << endl;
+		}
+	}
+
+	//Run the tasks
+	if(success)
+	{
+		boost::thread_group threads;
+		for(int t = 0; t < n_threads; t++)
+		{
+			threads.create_thread(boost::bind(evaluate_selection_task, &tasks[t]));
+		}
+		threads.join_all();
+	}
+	for(int t = 0; t < n_threads; t++)
+	{
+		success = success && !tasks[t].out_of_memory && !tasks[t].read_error;
+	}
+
+	//Merge the results in entry order (the tasks are
+	//contiguous and ordered, so this is just a concatenation)
+	//and clean up
+	for(int t = 0; t < n_threads; t++)
+	{
+		selected_entries.insert(selected_entries.end(),
+								tasks[t].selected_entries.begin(),
+								tasks[t].selected_entries.end());
+		merge_selection_counts(selection, *tasks[t].selection);
+		if(tasks[t].chain != NULL)
+		{
+			tasks[t].chain->SetNotify(NULL);
+		}
+		delete_selection(*tasks[t].selection);
+		delete tasks[t].selection;
+		delete tasks[t].prefetcher;
+		delete tasks[t].chain;
+	}
+
+	return success;
+}
+
+int write_entry_index(TChain *chain,
+					  TFile *file,
+					  TTree *index_tree,
+					  vector<Define> &defines,
+					  const vector<Long64_t> &selected_entries,
+					  int max_output_events,
+					  ProgressReporter &progress)
+{
+	//The entry list refers to the trees of the chain, so
+	//it can be applied directly to the same input.  Returns
+	//-1 if an entry can't be read.
+	file->cd();
+	TEntryList *entry_list = new TEntryList(ENTRY_LIST_NAME.c_str(), "Entries passing the selection");
+
+	//The index tree has one row per selected entry, in
+	//order, locating it in the input, along with any
+	//definitions
+	Long64_t entry = 0;
+	Int_t tree_number = 0;
+	Long64_t local_entry = 0;
+	index_tree->Branch("entry", &entry, "entry/L");
+	index_tree->Branch("tree_number", &tree_number, "tree_number/I");
+	index_tree->Branch("local_entry", &local_entry, "local_entry/L");
+	int output_events = 0;
+	const vector<OutputStream> no_streams;
+	vector<Long64_t>::const_iterator selected_entry;
+	for(selected_entry = selected_entries.begin();
+		selected_entry != selected_entries.end();
+		selected_entry++)
+	{
+		update_progress(progress, output_events, -1);
+		entry = *selected_entry;
+		local_entry = chain->LoadTree(entry);
+		if(local_entry < 0)
+		{
+			cerr << "ERROR: Unable to read entry " << entry << " of the input." << endl;
+			return -1;
+		}
+		tree_number = chain->GetTreeNumber();
+		entry_list->Enter(entry, chain);
+		evaluate_defines(defines, no_streams, local_entry);
+		index_tree->Fill();
+		if(++output_events == max_output_events)
+		{
+			break;
+		}
+	}
+	finish_progress(progress, output_events, -1);
+
+	return output_events;
+}
+
+int copy_selected_entries(TTree *old_tree,
+						  TTree *new_tree,
+						  vector<Define> &defines,
+						  ColumnarOutput *columnar,
+						  const vector<Long64_t> &selected_entries,
+						  int max_output_events,
+						  int optimize_baskets_after,
+						  Long64_t optimize_baskets_memory,
+						  ProgressReporter &progress,
+						  MemoryMonitor &memory)
+{
+	//Copy the selected entries, in order.  Returns -1 if
+	//the memory ceiling is exceeded or an entry can't be
+	//read.
+	vector<TTree *> outputs(1, new_tree);
+	const vector<OutputStream> no_streams;
+	int output_events = 0;
+	vector<Long64_t>::const_iterator entry;
+	for(entry = selected_entries.begin();
+		entry != selected_entries.end();
+		entry++)
+	{
+		update_progress(progress, output_events, -1);
+		if(!update_memory(memory, old_tree, outputs, output_events))
+		{
+			return -1;
+		}
+		Long64_t local_entry = old_tree->LoadTree(*entry);
+		if(local_entry < 0)
+		{
+			cerr << "ERROR: Unable to read entry " << *entry << " of the input." << endl;
+			return -1;
+		}
+		old_tree->GetEntry(*entry);
+		evaluate_defines(defines, no_streams, local_entry);
+		new_tree->Fill();
+		append_columnar_entry(columnar);
+		if(++output_events == optimize_baskets_after)
+		{
+			new_tree->OptimizeBaskets(optimize_baskets_memory);
+		}
+		if(output_events == max_output_events)
+		{
+			break;
+		}
+	}
+	finish_progress(progress, output_events, -1);
+
+	return output_events;
+}
+
+bool can_fast_clone(po::variables_map options)
+{
+	//Fast cloning copies the compressed baskets as-is,
+	//so it can't change their compression, layout or
+	//contents, and it doesn't evaluate anything for a
+	//cutflow
+	return (options.count("no-fast-clone") == 0
+			&& options.count("compression") == 0
+			&& options.count("branch-compression") == 0
+			&& options.count("basket-size") == 0
+			&& options.count("auto-flush") == 0
+			&& options.count("max-memory") == 0
+			&& options.count("optimize-baskets") == 0
+			&& options.count("cutflow") == 0
+			&& options.count("cutflow-weight") == 0
+			&& options.count("object-selection") == 0
+			&& options.count("define") == 0
+			&& options.count("entry-list-output") == 0
+			&& options.count("columnar-output") == 0);
+}
+
+//A single input file, skimmed independently of the
+//others into its own temporary output as part of a
+//per-file parallel skim
+struct FileSkimTask
+{
+	string input;
+	string output;
+	Long64_t input_events;
+	int output_events;
+	bool skipped;
+	bool success;
+};
+
+//The work shared by the workers of a per-file parallel
+//skim.  Workers take the next file from the queue until
+//it is empty.
+struct FileSkimQueue
+{
+	po::variables_map options;
+	vector<FileSkimTask> tasks;
+	size_t next_task;
+	int retries;
+	bool fast_clone;
+	int optimize_baskets_after;
+	Long64_t optimize_baskets_memory;
+	boost::mutex queue_mutex;
+	boost::mutex setup_mutex;
+};
+
+bool skim_file(FileSkimQueue &queue, FileSkimTask &task)
+{
+	//Determine operating parameters
+	po::variables_map &options = queue.options;
+	string container = options["container"].as<string>();
+
+	task.input_events = 0;
+	task.output_events = 0;
+
+	//Set up the input, output and selection.  This goes
+	//through the interpreter, so only one worker does it
+	//at a time.
+	TChain *chain = new TChain(container.c_str());
+	OutputStream stream;
+	stream.options = options;
+	stream.output = task.output;
+	ChainNotifier notifier;
+	EntryReader entry_reader(chain);
+	bool opened = false;
+	{
+		boost::mutex::scoped_lock lock(queue.setup_mutex);
+		if(chain->Add(task.input.c_str(), 0) != 1)
+		{
+			//A file without the container is skipped, as it
+			//would be by the chain of a single skim
+			delete chain;
+			TFile *file = TFile::Open(task.input.c_str());
+			task.skipped = (file != NULL && !file->IsZombie()
+							&& dynamic_cast<TTree *>(file->Get(container.c_str())) == NULL);
+			delete file;
+			if(task.skipped)
+			{
+				cerr << "WARNING: " << task.input << " doesn't contain " << container << ", skipping it." << endl;
+				return true;
+			}
+			cerr << "ERROR: Unable to open the input file (" << task.input << ") for reading." << endl;
+			return false;
+		}
+		vector<Define> no_defines;
+		opened = open_output_stream(options, chain, no_defines, stream);
+		if(opened)
+		{
+			compile_selection_from_options(options, chain, stream.selection);
+			add_selection_to_notifier(stream.selection, notifier);
+			entry_reader.Notify();
+			notifier.Add(&entry_reader);
+			chain->SetNotify(&notifier);
+		}
+	}
+
+	//Skim the file, exactly as a single-threaded run would
+	bool success = opened;
+	if(opened)
+	{
+		set<string> read_branches = stream.enabled_branches;
+		get_selection_branches(stream.selection, read_branches);
+		configure_cache_from_options(options, chain, read_branches);
+
+		Long64_t n_events = chain->GetEntries();
+		if(queue.fast_clone && stream.selection.expression == TRIVIAL_SELECTION)
+		{
+			stream.output_events = stream.tree->CopyEntries(chain, -1, "fast");
+		}
+		else
+		{
+			for(Long64_t i = 0; i < n_events; i++)
+			{
+				//Read errors are what make a file worth
+				//retrying, so don't ignore them
+				Long64_t local_entry = chain->LoadTree(i);
+				if(local_entry < 0)
+				{
+					success = false;
+					break;
+				}
+				if(!evaluate_selection(stream.selection, local_entry))
+				{
+					continue;
+				}
+				if(entry_reader.Read(i, local_entry) < 0)
+				{
+					success = false;
+					break;
+				}
+				stream.tree->Fill();
+				if(++stream.output_events == queue.optimize_baskets_after)
+				{
+					stream.tree->OptimizeBaskets(queue.optimize_baskets_memory);
+				}
+			}
+		}
+		if(!success)
+		{
+			cerr << "ERROR: Unable to read the input file (" << task.input << ")." << endl;
+		}
+		task.input_events = n_events;
+		task.output_events = stream.output_events;
+	}
+
+	//Clean up
+	boost::mutex::scoped_lock lock(queue.setup_mutex);
+	success = close_output_stream(stream, success) && success;
+	chain->SetNotify(NULL);
+	delete chain;
+
+	return success;
+}
+
+void run_file_skim_worker(FileSkimQueue *queue)
+{
+	//Determine operating parameters
+	bool verbose = (queue->options.count("verbose") > 0);
+
+	while(true)
+	{
+		//Take the next file, if there is one
+		FileSkimTask *task = NULL;
+		{
+			boost::mutex::scoped_lock lock(queue->queue_mutex);
+			if(queue->next_task == queue->tasks.size())
+			{
+				return;
+			}
+			task = &queue->tasks[queue->next_task++];
+		}
+
+		//Skim it, trying again on failure
+		for(int attempt = 0; attempt <= queue->retries && !task->success; attempt++)
+		{
+			if(attempt > 0)
+			{
+				cerr << "WARNING: Retrying " << task->input << " (attempt " << attempt + 1 << ")" << endl;
+			}
+			task->success = skim_file(*queue, *task);
+		}
+
+		if(verbose && task->success && !task->skipped)
+		{
+			boost::mutex::scoped_lock lock(queue->queue_mutex);
+			cout << "Skimmed " << task->input << ": " << task->output_events << " of "
+				 << task->input_events << " entries selected" << endl;
+		}
+	}
+}
+
+bool merge_outputs(po::variables_map options, const vector<string> &parts)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string output = options["output"].as<string>();
+	bool replace = (options.count("replace") > 0);
+
+	//Use the compression of the files being merged, so that
+	//the merger can copy the compressed baskets as-is
+	TFile *first = TFile::Open(parts.front().c_str());
+	if(first == NULL)
+	{
+		cerr << "ERROR: Unable to open the file to merge (" << parts.front() << ")." << endl;
+		return false;
+	}
+	int settings = first->GetCompressionSettings();
+	first->Close();
+	delete first;
+
+	//Merge the outputs, in input order
+	TFileMerger merger(kFALSE);
+	merger.SetFastMethod(kTRUE);
+	merger.SetPrintLevel(verbose ? 1 : 0);
+	string output_options = replace ? "RECREATE" : "CREATE";
+	if(!merger.OutputFile(output.c_str(), output_options.c_str(), settings))
+	{
+		cerr << "ERROR: Unable to open the output file (" << output << ") for writing." << endl;
+		return false;
+	}
+	vector<string>::const_iterator part;
+	for(part = parts.begin();
+		part != parts.end();
+		part++)
+	{
+		if(!merger.AddFile(part->c_str(), kFALSE))
+		{
+			cerr << "ERROR: Unable to add " << *part << " to the merge." << endl;
+			return false;
+		}
+	}
+	if(!merger.Merge())
+	{
+		cerr << "ERROR: Unable to merge the outputs." << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool skim_files_in_parallel(po::variables_map options, TChain *chain, int n_jobs)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string output = options["output"].as<string>();
+
+	//Let ROOT know that it will be used from multiple
+	//threads
+	ROOT::EnableThreadSafety();
+
+	//Create a task for each input file.  Temporary outputs
+	//are always replaced, so a retry can start over.
+	FileSkimQueue queue;
+	queue.options = options;
+	queue.options.insert(make_pair(string("replace"), po::variable_value()));
+	queue.next_task = 0;
+	queue.retries = options["file-retries"].as<int>();
+	queue.fast_clone = can_fast_clone(options);
+	queue.optimize_baskets_after = -1;
+	if(options.count("optimize-baskets") > 0)
+	{
+		queue.optimize_baskets_after = options["optimize-baskets"].as<int>();
+	}
+	queue.optimize_baskets_memory = options["optimize-baskets-memory"].as<Long64_t>();
+	TObjArray *files = chain->GetListOfFiles();
+	for(Int_t i = 0; i < files->GetEntries(); i++)
+	{
+		FileSkimTask task;
+		task.input = files->At(i)->GetTitle();
+		ostringstream part;
+		part << output << ".part" << i << ".root";
+		task.output = part.str();
+		task.input_events = 0;
+		task.output_events = 0;
+		task.skipped = false;
+		task.success = false;
+		queue.tasks.push_back(task);
+	}
+	if(verbose)
+	{
+		cout << "Skimming " << queue.tasks.size() << " files with " << n_jobs << " jobs" << endl;
+	}
+
+	//Run the workers
+	boost::thread_group workers;
+	for(int j = 0; j < n_jobs; j++)
+	{
+		workers.create_thread(boost::bind(run_file_skim_worker, &queue));
+	}
+	workers.join_all();
+
+	//Merge the outputs if every file was skimmed
+	bool success = true;
+	vector<string> parts;
+	vector<FileSkimTask>::iterator task;
+	for(task = queue.tasks.begin();
+		task != queue.tasks.end();
+		task++)
+	{
+		if(!task->success)
+		{
+			cerr << "ERROR: Unable to skim " << task->input << endl;
+			success = false;
+		}
+		else if(!task->skipped)
+		{
+			parts.push_back(task->output);
+		}
+	}
+	if(success && parts.size() == 0)
+	{
+		cerr << "ERROR: None of the input files contain " << options["container"].as<string>() << endl;
+		success = false;
+	}
+	success = success && merge_outputs(options, parts);
+
+	//Clean up the temporary outputs
+	for(task = queue.tasks.begin();
+		task != queue.tasks.end();
+		task++)
+	{
+		gSystem->Unlink(task->output.c_str());
+	}
+
+	return success;
+}
+
+string get_first_input_path(po::variables_map options)
+{
+	//The first non-comment line of the input list
+	if(options.count("input-list") > 0)
+	{
+		ifstream list(options["input-list"].as<string>().c_str());
+		string line;
+		while(getline(list, line))
+		{
+			trim(line);
+			if(line.length() > 0 && line[0] != '#')
+			{
+				istringstream fields(line);
+				string path;
+				fields >> path;
+				return path;
+			}
+		}
+		return "";
+	}
+
+	//Let the chain expand any wildcards, without opening
+	//the files
+	TChain probe(options["container"].as<string>().c_str());
+	probe.Add(options["input"].as<string>().c_str());
+	TObjArray *files = probe.GetListOfFiles();
+	if(files->GetEntries() == 0)
+	{
+		return "";
+	}
+	return files->At(0)->GetTitle();
+}
+
+#ifdef SKIMSLIM_WITH_RNTUPLE
+
+bool matches_pattern(const string &name, const string &pattern)
+{
+	TRegexp regexp(pattern.c_str(), kTRUE);
+	TString value = name.c_str();
+	Ssiz_t length = 0;
+	return (regexp.Index(value, &length) == 0 && length == value.Length());
+}
+
+void get_output_columns(po::variables_map options,
+						const vector<string> &names,
+						const vector< pair<string, string> > &definitions,
+						vector<string> &columns)
+{
+	//Apply the branch options to the input columns in the
+	//same order as set_branches_from_options, so that they
+	//select the same branches from a tree
+	bool disable_all = (options.count("disable-all-branches") > 0);
+	vector<string> disabled_branches;
+	if(options.count("disable-branches") > 0)
+	{
+		disabled_branches = options["disable-branches"].as< vector<string> >();
+	}
+	vector<string> enabled_branches;
+	if(options.count("enable-branches") > 0)
+	{
+		enabled_branches = options["enable-branches"].as< vector<string> >();
+	}
+	set<string> defined;
+	vector< pair<string, string> >::const_iterator definition;
+	for(definition = definitions.begin();
+		definition != definitions.end();
+		definition++)
+	{
+		defined.insert(definition->first);
+	}
+
+	vector<string> enabled_columns;
+	set<string> written;
+	vector<string>::const_iterator name;
+	for(name = names.begin();
+		name != names.end();
+		name++)
+	{
+		//Definitions are always written (below)
+		if(name->compare(0, 6, "R_rdf_") == 0 || defined.count(*name) > 0)
+		{
+			continue;
+		}
+		bool enabled = !disable_all;
+		vector<string>::iterator pattern;
+		for(pattern = disabled_branches.begin();
+			pattern != disabled_branches.end() && enabled;
+			pattern++)
+		{
+			enabled = !matches_pattern(*name, *pattern);
+		}
+		for(pattern = enabled_branches.begin();
+			pattern != enabled_branches.end() && !enabled;
+			pattern++)
+		{
+			enabled = matches_pattern(*name, *pattern);
+		}
+		if(enabled)
+		{
+			enabled_columns.push_back(*name);
+			written.insert(*name);
+		}
+	}
+
+	//Sub-fields of a record are written with it, so are only
+	//columns of their own when no enclosing field is written
+	for(name = enabled_columns.begin();
+		name != enabled_columns.end();
+		name++)
+	{
+		bool enclosed = false;
+		for(size_t dot = name->find('.');
+			dot != string::npos && !enclosed;
+			dot = name->find('.', dot + 1))
+		{
+			enclosed = (written.count(name->substr(0, dot)) > 0);
+		}
+		if(!enclosed)
+		{
+			columns.push_back(*name);
+		}
+	}
+	for(definition = definitions.begin();
+		definition != definitions.end();
+		definition++)
+	{
+		columns.push_back(definition->first);
+	}
+}
+
+bool skim_with_dataframe(po::variables_map options, bool rntuple_input, bool rntuple_output)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string container = options["container"].as<string>();
+	string output = options["output"].as<string>();
+	bool replace = (options.count("replace") > 0);
+	int threads = 1;
+	if(options.count("threads") > 0)
+	{
+		threads = options["threads"].as<int>();
+	}
+
+	//Options which only exist for the tree path
+	const char *unsupported[] = {"stream", "file-jobs", "object-selection", "cutflow", "cutflow-weight",
+								 "selection-cache", "entry-list-output", "columnar-output", "shard",
+								 "cluster-index", "branch-compression", "basket-size", "auto-flush",
+								 "optimize-baskets", "stats", "stats-json", "progress", "max-memory",
+								 "two-phase", "compile-selection", "batch-size", "short-circuit",
+								 "reorder-cuts", "cache-size", "cache-branches", "prefetch",
+								 "prefetch-cache-dir", "output-threads"};
+	for(size_t i = 0; i < sizeof(unsupported) / sizeof(unsupported[0]); i++)
+	{
+		if(options.count(unsupported[i]) > 0)
+		{
+			cerr << "ERROR: --" << unsupported[i] << " isn't supported with RNTuple input or output" << endl;
+			return false;
+		}
+	}
+	Long64_t first_entry = 0;
+	if(options.count("first-event") > 0)
+	{
+		first_entry = options["first-event"].as<Long64_t>();
+	}
+	Long64_t end_entry = 0;
+	if(options.count("max-input-events") > 0)
+	{
+		end_entry = first_entry + options["max-input-events"].as<int>();
+	}
+	Long64_t max_output_events = 0;
+	if(options.count("max-output-events") > 0)
+	{
+		max_output_events = options["max-output-events"].as<int>();
+	}
+	if(threads > 1 && (first_entry > 0 || end_entry > 0 || max_output_events > 0))
+	{
+		cerr << "ERROR: Event limits and ranges can't be used with threads when reading or writing RNTuple" << endl;
+		return false;
+	}
+	if(!replace && !gSystem->AccessPathName(output.c_str()))
+	{
+		cerr << "ERROR: Unable to open the output file (" << output << ") for writing." << endl;
+		return false;
+	}
+
+	//Gather the inputs.  A wildcard is expanded by the data
+	//frame itself.
+	vector<string> inputs;
+	if(options.count("input-list") > 0)
+	{
+		TChain probe(container.c_str());
+		if(!add_inputs_from_list(options, &probe))
+		{
+			return false;
+		}
+		TObjArray *files = probe.GetListOfFiles();
+		for(Int_t i = 0; i < files->GetEntries(); i++)
+		{
+			inputs.push_back(files->At(i)->GetTitle());
+		}
+	}
+	else
+	{
+		inputs.push_back(options["input"].as<string>());
+	}
+
+	//Get the definitions and cuts
+	vector< pair<string, string> > definitions;
+	vector<string> cuts;
+	if(!get_defines_from_options(options, definitions)
+	   || !get_selection_cuts_from_options(options, cuts))
+	{
+		return false;
+	}
+
+	//Set up the output
+	ROOT::RDF::RSnapshotOptions snapshot;
+	snapshot.fMode = "RECREATE";
+	snapshot.fOutputFormat = rntuple_output ? ROOT::RDF::ESnapshotOutputFormat::kRNTuple
+											: ROOT::RDF::ESnapshotOutputFormat::kTTree;
+	if(options.count("compression") > 0)
+	{
+		int settings = 0;
+		if(!parse_compression_settings(options["compression"].as<string>(), settings))
+		{
+			return false;
+		}
+		snapshot.fCompressionAlgorithm = (ROOT::RCompressionSetting::EAlgorithm::EValues)(settings / 100);
+		snapshot.fCompressionLevel = settings % 100;
+	}
+
+	if(verbose)
+	{
+		cout << "Reading " << (rntuple_input ? "RNTuple" : "TTree") << " input and writing "
+			 << (rntuple_output ? "RNTuple" : "TTree") << " output with RDataFrame" << endl;
+	}
+
+	//The selection is just-in-time compiled by the data
+	//frame, so its cuts are C++ expressions over the
+	//columns, as are the definitions
+	try
+	{
+#ifdef R__USE_IMT
+		if(threads > 1)
+		{
+			ROOT::EnableImplicitMT(threads);
+		}
+#endif
+		ROOT::RDataFrame frame(container, inputs);
+		ROOT::RDF::RNode node = frame;
+		if(first_entry > 0 || end_entry > 0)
+		{
+			node = node.Range(first_entry, end_entry);
+		}
+		ROOT::RDF::RResultPtr<ULong64_t> input_events = node.Count();
+		vector< pair<string, string> >::iterator definition;
+		for(definition = definitions.begin();
+			definition != definitions.end();
+			definition++)
+		{
+			node = node.Define(definition->first, definition->second);
+		}
+		vector<string>::iterator cut;
+		for(cut = cuts.begin();
+			cut != cuts.end();
+			cut++)
+		{
+			node = node.Filter(*cut);
+		}
+		if(max_output_events > 0)
+		{
+			node = node.Range(max_output_events);
+		}
+		ROOT::RDF::RResultPtr<ULong64_t> output_events = node.Count();
+
+		//Slim the columns and write the output.  The counts
+		//are filled in the same event loop.
+		vector<string> columns;
+		get_output_columns(options, frame.GetColumnNames(), definitions, columns);
+		if(columns.empty())
+		{
+			cerr << "ERROR: No columns are enabled for the output" << endl;
+			return false;
+		}
+		node.Snapshot(container, output, columns, snapshot);
+
+		if(verbose)
+		{
+			cout << "Processed " << *input_events << " input events, wrote "
+				 << *output_events << " events" << endl;
+		}
+	}
+	catch(std::exception &e)
+	{
+		cerr << "ERROR: Unable to skim with RDataFrame: " << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+bool skim_with_dataframe(po::variables_map options, bool rntuple_input, bool rntuple_output)
+{
+	cerr << "ERROR: RNTuple input and output need ROOT 6.34 or later" << endl;
+	return false;
+}
+
+#endif
+
+//The process-wide ROOT settings which a skim may change (the
+//error level, prefetching and implicit multithreading), put
+//back as they were when the skim returns so that a host
+//application, or the next skim in it, doesn't inherit them
+class ProcessSettings
+{
+	public:
+		ProcessSettings() :
+			error_ignore_level(gErrorIgnoreLevel),
+			async_prefetching(gEnv->GetValue("TFile.AsyncPrefetching", 0)),
+			cache_directory(gEnv->GetValue("Cache.Directory", "")),
+			implicit_mt(false)
+		{
+#ifdef R__USE_IMT
+			implicit_mt = ROOT::IsImplicitMTEnabled();
+#endif
+		}
+
+		~ProcessSettings()
+		{
+			gErrorIgnoreLevel = error_ignore_level;
+			gEnv->SetValue("TFile.AsyncPrefetching", async_prefetching);
+			gEnv->SetValue("Cache.Directory", cache_directory.c_str());
+#ifdef R__USE_IMT
+			//A pool which was already running is left alone,
+			//as ROOT can't resize it
+			if(!implicit_mt && ROOT::IsImplicitMTEnabled())
+			{
+				ROOT::DisableImplicitMT();
+			}
+#endif
+		}
+
+	private:
+		Int_t error_ignore_level;
+		Int_t async_prefetching;
+		string cache_directory;
+		bool implicit_mt;
+};
+
+void release_input(TChain *chain, bool owned)
+{
+	//Delete a chain created for this skim, or reset one
+	//which was lent to us to the state the next skim
+	//expects
+	if(owned)
+	{
+		delete chain;
+		return;
+	}
+	chain->SetNotify(NULL);
+	chain->SetPerfStats(NULL);
+	chain->ResetBranchAddresses();
+	chain->SetBranchStatus("*", 1);
+}
+
+int abandon_skim(TChain *old_tree,
+				 bool own_input,
+				 vector<OutputStream> &streams,
+				 ColumnarOutput *columnar,
+				 vector<Define> &defines)
+{
+	//Remove the outputs of a skim which failed once they
+	//were set up, and release everything it holds
+	old_tree->SetNotify(NULL);
+	close_output_streams(streams, false);
+	close_columnar_output(columnar, false);
+	delete_defines(defines);
+	release_input(old_tree, own_input);
+	return 1;
+}
+}
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+bool is_identifier(const string &name)
+{
+	if(name.length() == 0 || !(isalpha(name[0]) || name[0] == '_'))
+	{
+		return false;
+	}
+	for(size_t i = 1; i < name.length(); i++)
+	{
+		if(!(isalnum(name[i]) || name[i] == '_'))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool range_can_pass(const BranchRange &range, const RangeCut &cut)
+{
+	//A range which isn't known can't rule anything out
+	if(std::isnan(range.minimum) || std::isnan(range.maximum))
+	{
+		return true;
+	}
+	if(cut.comparison == "<")
+	{
+		return range.minimum < cut.value;
+	}
+	if(cut.comparison == "<=")
+	{
+		return range.minimum <= cut.value;
+	}
+	if(cut.comparison == ">")
+	{
+		return range.maximum > cut.value;
+	}
+	if(cut.comparison == ">=")
+	{
+		return range.maximum >= cut.value;
+	}
+	return range.minimum <= cut.value && cut.value <= range.maximum;
+}
+
+void get_range_cuts_from_options(po::variables_map options, vector<RangeCut> &range_cuts)
+{
+	//Any file may be needed by another stream
+	range_cuts.clear();
+	if(options.count("stream") > 0)
+	{
+		return;
+	}
+
+	//The cuts are all required, as are the terms of a cut
+	//which is only a conjunction, so any of them of the
+	//simple form can be used
+	po::variables_map quiet_options = options;
+	quiet_options.erase("verbose");
+	vector<string> cuts;
+	vector< pair<string, string> > definitions;
+	if(!get_selection_cuts_from_options(quiet_options, cuts)
+	   || !get_defines_from_options(quiet_options, definitions))
+	{
+		return;
+	}
+	vector<string>::iterator cut;
+	for(cut = cuts.begin();
+		cut != cuts.end();
+		cut++)
+	{
+		//Definitions are written out, so that only input
+		//branches are compared
+		*cut = expand_defines(*cut, definitions);
+		if(cut->find("||") != string::npos)
+		{
+			continue;
+		}
+		string::size_type start = 0;
+		while(start != string::npos)
+		{
+			string::size_type end = cut->find("&&", start);
+			string term = cut->substr(start, end == string::npos ? string::npos : end - start);
+			RangeCut range_cut;
+			if(parse_range_cut(term, range_cut))
+			{
+				range_cuts.push_back(range_cut);
+			}
+			start = (end == string::npos) ? end : end + 2;
+		}
+	}
+}
+
+bool add_inputs_from_options(po::variables_map options, TChain *chain)
+{
+	//Use the input list if given
+	if(options.count("input-list") > 0)
+	{
+		return add_inputs_from_list(options, chain);
+	}
+
+	//Determine operating parameters
+	string input = options["input"].as<string>();
+
+	//Add the input paths.  If we are using wildcarding, then
+	//we can just call Add with that value, though we need to
+	//verify that there were actually files attached, or ROOT
+	//will segfault.  It doesn't matter if those files
+	//actually contain the requested tree, ROOT will just
+	//ignore them if they don't, but it can't handle not
+	//finding any files.  If we aren't using wildcarding, i.e.
+	//if we are specifying a file, then we need to call Add
+	//with the second argument of 0 to check that that it 
+	//actually worked.  Note that if we do call Add with the
+	//second argument of 0 and it doesn't return the number
+	//of paths we gave it, then it will segfault later, so we
+	//really need to check here to make sure it is successful.
+	if(input.find("*") != string::npos)
+	{
+		//We are using wildcarding, so just add the file,
+		//but check that there are matches.
+		if(chain->Add(input.c_str()) == 0)
+		{
+			//Unable to open any input files
+			cerr << "ERROR: No input files matched the specification" << endl;
+			return false;
+		}
+	}
+	else if(chain->Add(input.c_str(), 0) != 1)
+	{
+		//Unable to open the file
+		cerr << "ERROR: Unable to open the input file (" << input << ") for reading." << endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool is_rntuple_input(po::variables_map options)
+{
+	//Look at the class of the container in the first input
+	//file.  If it can't be opened, treat it as a tree and
+	//let the usual path report the error.
+	string path = get_first_input_path(options);
+	if(path.length() == 0)
+	{
+		return false;
+	}
+	TFile *file = TFile::Open(path.c_str());
+	if(file == NULL)
+	{
+		return false;
+	}
+	bool rntuple = false;
+	TKey *key = file->GetKey(options["container"].as<string>().c_str());
+	if(key != NULL)
+	{
+		string class_name = key->GetClassName();
+		rntuple = (class_name == "ROOT::RNTuple" || class_name == "ROOT::Experimental::RNTuple");
+	}
+	file->Close();
+	delete file;
+	return rntuple;
+}
+
+//The skim itself, which leaves the error level and restoring
+//process settings to the caller
+int skim(po::variables_map options, TChain *input_chain)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Merge previous outputs if requested
+	if(options.count("merge") > 0)
+	{
+		return merge_outputs(options, options["merge"].as< vector<string> >()) ? 0 : 1;
+	}
+
+	if(options.count("input") + options.count("input-list") != 1)
+	{
+		cerr << "ERROR: Exactly one of --input and --input-list must be given" << endl;
+		return 1;
+	}
+	if(options.count("container") == 0)
+	{
+		cerr << "ERROR: The input container must be given" << endl;
+		return 1;
+	}
+	string input = (options.count("input") > 0) ? options["input"].as<string>() : options["input-list"].as<string>();
+	string container = options["container"].as<string>();
+	string output = options["output"].as<string>();
+	int max_input_events = -1;
+	if(options.count("max-input-events") > 0)
+	{
+		max_input_events = options["max-input-events"].as<int>();
+
+		//If the user has specified a value, make sure it is > 0.
+		//If we're using the default, it's fine to be < 0.
+		if(max_input_events <= 0)
+		{
+			cerr << "ERROR: Maximum input events must be > 0 to make sense" << endl;
+			return 1;
+		}
+	}
+	int max_output_events = -1;
+	if(options.count("max-output-events") > 0)
+	{
+		max_output_events = options["max-output-events"].as<int>();
+
+		//If the user has specified a value, make sure it is > 0.
+		//If we're using the default, it's fine to be < 0.
+		if(max_output_events <= 0)
+		{
+			cerr << "ERROR: Maximum output events must be > 0 to make sense" << endl;
+			return 1;
+		}
+	}
+	//The selection cache and entry list output imply
+	//two-phase selection, so errors name the option given
+	string two_phase_option;
+	if(options.count("two-phase") > 0)
+	{
+		two_phase_option = "--two-phase";
+	}
+	else if(options.count("selection-cache") > 0)
+	{
+		two_phase_option = "--selection-cache (which implies --two-phase)";
+	}
+	else if(options.count("entry-list-output") > 0)
+	{
+		two_phase_option = "--entry-list-output (which implies --two-phase)";
+	}
+	bool two_phase = (two_phase_option.length() > 0);
+	int optimize_baskets_after = -1;
+	Long64_t optimize_baskets_memory = options["optimize-baskets-memory"].as<Long64_t>();
+	if(options.count("optimize-baskets") > 0)
+	{
+		optimize_baskets_after = options["optimize-baskets"].as<int>();
+		if(optimize_baskets_after <= 0)
+		{
+			cerr << "ERROR: Basket optimization warm-up must be > 0 entries to make sense" << endl;
+			return 1;
+		}
+	}
+	Long64_t output_budget = get_memory_budget(options, MEMORY_OUTPUT_FRACTION);
+	if(options.count("max-memory") > 0)
+	{
+		if(options["max-memory"].as<Long64_t>() <= 0)
+		{
+			cerr << "ERROR: Maximum memory must be > 0 bytes to make sense" << endl;
+			return 1;
+		}
+		optimize_baskets_memory = min(optimize_baskets_memory, output_budget);
+	}
+	bool fast_clone = can_fast_clone(options);
+	int threads = 1;
+	if(options.count("threads") > 0)
+	{
+		threads = options["threads"].as<int>();
+		if(threads <= 0)
+		{
+			cerr << "ERROR: Number of threads must be > 0 to make sense" << endl;
+			return 1;
+		}
+	}
+	if(options.count("selection-cache") > 0
+	   && (options.count("cutflow") > 0 || options.count("cutflow-weight") > 0))
+	{
+		cerr << "ERROR: A cutflow can't be recorded when using the selection cache" << endl;
+		return 1;
+	}
+	if(max_output_events >= 0
+	   && (options.count("cutflow") > 0 || options.count("cutflow-weight") > 0))
+	{
+		//The skim stops at the limit, so the cutflow would
+		//only count the entries read before it
+		cerr << "ERROR: A cutflow can't be recorded with a maximum number of output events" << endl;
+		return 1;
+	}
+	if(options.count("object-selection") > 0 && two_phase)
+	{
+		cerr << "ERROR: Object selections can't be used with " << two_phase_option << endl;
+		return 1;
+	}
+	if(options.count("object-selection") > 0
+	   && (options.count("stream") > 0 || options.count("file-jobs") > 0 || threads > 1))
+	{
+		cerr << "ERROR: Object selections can only be used with a single output stream and"
+			 << " single-threaded, single-pass selection" << endl;
+		return 1;
+	}
+	if(options.count("columnar-output") > 0 && options.count("entry-list-output") > 0)
+	{
+		cerr << "ERROR: Columnar output can't be combined with entry list output" << endl;
+		return 1;
+	}
+	if(options.count("stream") > 0 && two_phase)
+	{
+		cerr << "ERROR: Additional output streams can't be used with " << two_phase_option << endl;
+		return 1;
+	}
+	if(options.count("stream") > 0 && threads > 1)
+	{
+		cerr << "ERROR: Additional output streams can't be used with threaded selection" << endl;
+		return 1;
+	}
+	int file_jobs = 0;
+	if(options.count("file-jobs") > 0)
+	{
+		file_jobs = options["file-jobs"].as<int>();
+		if(file_jobs <= 0)
+		{
+			cerr << "ERROR: Number of file jobs must be > 0 to make sense" << endl;
+			return 1;
+		}
+		if(options["file-retries"].as<int>() < 0)
+		{
+			cerr << "ERROR: Number of file retries must be >= 0 to make sense" << endl;
+			return 1;
+		}
+		if(two_phase)
+		{
+			cerr << "ERROR: Per-file jobs can't be used with " << two_phase_option << endl;
+			return 1;
+		}
+		if(options.count("stream") > 0 || threads > 1
+		   || max_input_events >= 0 || max_output_events >= 0
+		   || options.count("first-event") > 0 || options.count("shard") > 0
+		   || options.count("define") > 0 || options.count("columnar-output") > 0
+		   || options.count("cutflow") > 0 || options.count("cutflow-weight") > 0)
+		{
+			cerr << "ERROR: Per-file jobs can't be used with additional output streams, threaded"
+				 << " selection, event limits or ranges, definitions, columnar output or a cutflow" << endl;
+			return 1;
+		}
+		if(options.count("max-memory") > 0)
+		{
+			//Each job would have the whole budget, and none
+			//of them watch it
+			cerr << "ERROR: Per-file jobs can't be used with a memory ceiling" << endl;
+			return 1;
+		}
+		if(options.count("cluster-index") > 0 || options.count("index-branches") > 0)
+		{
+			cerr << "ERROR: Per-file jobs can't be used with a cluster index" << endl;
+			return 1;
+		}
+	}
+	
+	//Print program information
+	if(verbose)
+	{
+		cout << "Physics tools skim/slim script" << endl;
+		if(options.count("input-list") > 0)
+		{
+			cout << "Input list: " << input << endl;
+		}
+		else
+		{
+			cout << "Input file: " << input << endl;
+		}
+		cout << "Input container: " << container << endl;
+		cout << "Output file: " << output << endl;
+		if(max_input_events >= 0)
+		{
+			cout << "Maximum input events: " << max_input_events << endl;
+		}
+		if(max_output_events >= 0)
+		{
+			cout << "Maximum output events: " << max_output_events << endl;
+		}
+		if(file_jobs > 0)
+		{
+			cout << "Per-file jobs: " << file_jobs << endl;
+		}
+		if(threads > 1)
+		{
+			cout << "Selection threads: " << threads << endl;
+		}
+		else if(two_phase)
+		{
+			cout << "Using two-phase selection" << endl;
+		}
+	}
+
+	//Read or write RNTuple through RDataFrame
+	string output_format = options["output-format"].as<string>();
+	if(output_format != "ttree" && output_format != "rntuple")
+	{
+		cerr << "ERROR: Unknown output format: " << output_format << endl;
+		return 1;
+	}
+	bool rntuple_input = (input_chain == NULL && is_rntuple_input(options));
+	if(rntuple_input || output_format == "rntuple")
+	{
+		return skim_with_dataframe(options, rntuple_input, output_format == "rntuple") ? 0 : 1;
+	}
+
+	//Set up prefetching before any file is opened
+	configure_prefetch_from_options(options);
+
+	//Set up parallel output compression
+	if(!configure_output_threads_from_options(options))
+	{
+		return 1;
+	}
+
+	//Create the input tree (which may be a chain of trees),
+	//unless one has been lent to us
+	TChain *old_tree = input_chain;
+	bool own_input = (input_chain == NULL);
+	if(own_input)
+	{
+		old_tree = new TChain(container.c_str());
+
+		//Add the input paths
+		if(!add_inputs_from_options(options, old_tree))
+		{
+			//Clean up and exit
+			delete old_tree;
+			return 1;
+		}
+	}
+
+	//Skim the files independently if requested
+	if(file_jobs > 0)
+	{
+		bool skimmed = skim_files_in_parallel(options, old_tree, file_jobs);
+		release_input(old_tree, own_input);
+		return skimmed ? 0 : 1;
+	}
+
+	//Set up the output streams.  The first stream is
+	//described by the command line, any others by stream
+	//files.
+	vector<OutputStream> streams(1);
+	init_output_stream(streams[0]);
+	streams[0].options = options;
+	streams[0].output = output;
+	if(options.count("stream") > 0)
+	{
+		vector<string> stream_files = options["stream"].as< vector<string> >();
+		vector<string>::iterator stream_file;
+		for(stream_file = stream_files.begin();
+			stream_file != stream_files.end();
+			stream_file++)
+		{
+			OutputStream stream;
+			init_output_stream(stream);
+			if(!parse_stream_file(*stream_file, verbose, stream.options))
+			{
+				//Clean up and exit
+				release_input(old_tree, own_input);
+				return 1;
+			}
+			if(options.count("define") > 0)
+			{
+				stream.options.insert(make_pair(string("define"), options["define"]));
+			}
+			stream.output = stream.options["output"].as<string>();
+			if(verbose)
+			{
+				cout << "Additional output file: " << stream.output << endl;
+			}
+			streams.push_back(stream);
+		}
+	}
+	vector<Define> defines;
+	if(!create_defines_from_options(options, old_tree, defines))
+	{
+		//Clean up and exit
+		return abandon_skim(old_tree, own_input, streams, NULL, defines);
+	}
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		if(!open_output_stream(options, old_tree, defines, streams[s]))
+		{
+			//Clean up and exit
+			return abandon_skim(old_tree, own_input, streams, NULL, defines);
+		}
+	}
+
+	//Watch the memory used while filling the outputs
+	MemoryMonitor memory;
+	start_memory_monitor(options, memory);
+	vector<TTree *> output_trees;
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		output_trees.push_back(streams[s].tree);
+	}
+	bool out_of_memory = false;
+	bool read_error = false;
+
+	//Read the union of everything the streams need.  With
+	//only one stream, the branch status is already right.
+	set<string> read_branches;
+	ChainNotifier notifier;
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		read_branches.insert(streams[s].enabled_branches.begin(), streams[s].enabled_branches.end());
+		get_selection_branches(streams[s].selection, read_branches);
+	}
+	get_define_branches(defines, read_branches);
+
+	//Also write the main stream as columns, if requested
+	ColumnarOutput *columnar = NULL;
+	if(!open_columnar_output_from_options(options, old_tree, defines, columnar))
+	{
+		//Clean up and exit
+		return abandon_skim(old_tree, own_input, streams, NULL, defines);
+	}
+
+	if(streams.size() > 1 || !defines.empty())
+	{
+		enable_only_branches(old_tree, read_branches);
+	}
+
+	//The copy needs the branches being copied, and any
+	//used by the definitions
+	set<string> copy_branches = streams[0].enabled_branches;
+	get_define_branches(defines, copy_branches);
+
+	//Compile the selections, if requested, and make sure
+	//they are all notified of tree changes
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		compile_selection_from_options(options, old_tree, streams[s].selection);
+		add_selection_to_notifier(streams[s].selection, notifier);
+	}
+	add_defines_to_notifier(defines, notifier);
+	add_columnar_to_notifier(columnar, notifier);
+
+	//Open upcoming files in the background, if requested
+	boost::shared_ptr<FilePrefetcher> prefetcher(create_prefetcher_from_options(options, old_tree));
+	if(prefetcher)
+	{
+		//The first file is already open, so start on the
+		//second straight away
+		notifier.Add(prefetcher.get());
+		prefetcher->Notify();
+	}
+
+	//Set up the object selections, which read their own
+	//branches
+	vector< boost::shared_ptr<ObjectSelection> > object_selections;
+	if(!create_object_selections_from_options(options, old_tree, object_selections))
+	{
+		//Clean up and exit
+		return abandon_skim(old_tree, own_input, streams, columnar, defines);
+	}
+	for(size_t o = 0; o < object_selections.size(); o++)
+	{
+		get_formula_branches(object_selections[o]->GetFormula(), read_branches);
+		notifier.Add(object_selections[o].get());
+	}
+
+	//Read selected entries without re-reading what the
+	//selections already have
+	EntryReader entry_reader(old_tree);
+	entry_reader.Notify();
+	notifier.Add(&entry_reader);
+
+	//HACK: Call SetNotify for the old_tree.  This is
+	//only necessary because we are using a TChain.
+	old_tree->SetNotify(&notifier);
+
+	//Figure out how many entries there are, and which of
+	//them to process
+	if(verbose)
+	{
+		cout << "There are " << old_tree->GetEntries() << " entries." << endl;
+	}
+	Long64_t first_event = 0;
+	Long64_t end_event = 0;
+	if(!get_entry_range_from_options(options, old_tree, first_event, end_event))
+	{
+		//Clean up and exit
+		return abandon_skim(old_tree, own_input, streams, columnar, defines);
+	}
+	Long64_t n_events = end_event - first_event;
+
+	//Find the clusters which can be skipped
+	ClusterIndex cluster_index;
+	if(!load_cluster_index_from_options(options, old_tree, cluster_index))
+	{
+		//Clean up and exit
+		return abandon_skim(old_tree, own_input, streams, columnar, defines);
+	}
+
+	//Start collecting statistics.  In threaded mode, I/O
+	//statistics are only collected for the copy pass.
+	SkimStatistics stats;
+	start_statistics(options, old_tree, read_branches, stats);
+	if(threads == 1)
+	{
+		attach_perf_stats(old_tree, stats);
+	}
+
+	//Loop over the entries
+	OutputStream &main_stream = streams[0];
+	if(streams.size() == 1
+	   && fast_clone
+	   && first_event == 0
+	   && main_stream.selection.expression == TRIVIAL_SELECTION)
+	{
+		//Every entry passes, so there is no need to
+		//decompress anything, just copy the baskets
+		//directly.  ROOT will fall back to a regular copy
+		//for any tree where this isn't possible.
+		Long64_t n_copy = n_events;
+		if(max_output_events >= 0)
+		{
+			n_copy = min(n_copy, (Long64_t)max_output_events);
+		}
+		if(verbose)
+		{
+			cout << "No selection applied, fast cloning " << n_copy << " entries" << endl;
+		}
+		main_stream.output_events = main_stream.tree->CopyEntries(old_tree, n_copy, "fast");
+		stats.input_events = n_copy;
+		stats.selected_events = n_copy;
+	}
+	else if(threads > 1 || two_phase)
+	{
+		//Evaluate the selection up front, unless it has
+		//already been evaluated for the same input
+		vector<Long64_t> selected_entries;
+		bool selected = false;
+		bool cached = false;
+		string cache_path;
+		if(options.count("selection-cache") > 0)
+		{
+			cache_path = get_selection_cache_path(options, old_tree, main_stream.selection.expression, first_event, end_event);
+			cached = load_selection_cache(cache_path, selected_entries);
+			selected = cached;
+			if(verbose)
+			{
+				cout << (cached ? "Using cached selection " : "Caching selection as ") << cache_path << endl;
+			}
+		}
+		if(!cached && threads > 1)
+		{
+			selected = select_entries_in_parallel(options,
+												  main_stream.selection,
+												  first_event,
+												  end_event,
+												  threads,
+												  cluster_index,
+												  memory,
+												  selected_entries);
+		}
+		else if(!cached)
+		{
+			selected = select_entries(options,
+									  old_tree,
+									  main_stream.selection,
+									  first_event,
+									  end_event,
+									  copy_branches,
+									  cluster_index,
+									  memory,
+									  selected_entries);
+		}
+		if(!selected)
+		{
+			cerr << "ERROR: Unable to evaluate selection." << endl;
+
+			//Clean up and exit
+			return abandon_skim(old_tree, own_input, streams, columnar, defines);
+		}
+		if(!cached && !cache_path.empty() && !save_selection_cache(cache_path, selected_entries))
+		{
+			cerr << "WARNING: Unable to save the selection to the cache (" << cache_path << ")." << endl;
+		}
+		if(verbose)
+		{
+			cout << selected_entries.size() << " entries passed the selection." << endl;
+		}
+
+		stats.input_events = n_events;
+		stats.selected_events = selected_entries.size();
+
+		//Copy the selected entries
+		ProgressReporter progress;
+		start_progress(options, "Copy", selected_entries.size(), progress);
+		if(threads > 1)
+		{
+			configure_cache_from_options(options, old_tree, copy_branches);
+			attach_perf_stats(old_tree, stats);
+		}
+		else if(cached)
+		{
+			configure_cache_from_options(options, old_tree, copy_branches);
+		}
+		if(options.count("entry-list-output") > 0)
+		{
+			main_stream.output_events = write_entry_index(old_tree,
+														  main_stream.file,
+														  main_stream.tree,
+														  defines,
+														  selected_entries,
+														  max_output_events,
+														  progress);
+			if(main_stream.output_events < 0)
+			{
+				read_error = true;
+				main_stream.output_events = 0;
+			}
+		}
+		else
+		{
+			main_stream.output_events = copy_selected_entries(old_tree,
+															  main_stream.tree,
+															  defines,
+															  columnar,
+															  selected_entries,
+															  max_output_events,
+															  optimize_baskets_after,
+															  optimize_baskets_memory,
+															  progress,
+															  memory);
+			if(main_stream.output_events < 0)
+			{
+				out_of_memory = memory.exceeded;
+				read_error = !memory.exceeded;
+				main_stream.output_events = 0;
+			}
+		}
+	}
+	else
+	{
+		//Cache both the branches we copy and those the
+		//selections read
+		configure_cache_from_options(options, old_tree, read_branches);
+
+		ProgressReporter progress;
+		start_progress(options, "Progress", n_events, progress);
+		for(size_t s = 0; s < streams.size(); s++)
+		{
+			set_selection_end(streams[s].selection, end_event);
+		}
+		size_t finished_streams = 0;
+		size_t cursor = 0;
+		for(Long64_t i = first_event; i < end_event && finished_streams < streams.size(); i++)
+		{
+			//Jump over clusters which can't pass
+			i = skip_clusters(&cluster_index, cursor, i);
+			if(i >= end_event)
+			{
+				break;
+			}
+			update_progress(progress, i - first_event, stats.selected_events);
+			if(!update_memory(memory, old_tree, output_trees, i - first_event))
+			{
+				out_of_memory = true;
+				break;
+			}
+
+			//Keep track of which file we are in
+			if(stats.enabled)
+			{
+				update_file_statistics(old_tree, i, stats);
+				stats.select_timer.Start(kFALSE);
+			}
+
+			//Set the entry in the old_tree (this doesn't 
+			//load any data just yet).  TTreeFormula will
+			//read what it needs.
+			Long64_t local_entry = old_tree->LoadTree(i);
+			if(local_entry < 0)
+			{
+				cerr << "ERROR: Unable to read entry " << i << " of the input." << endl;
+				read_error = true;
+				break;
+			}
+
+			//See if this entry is selected by each stream
+			bool selected = false;
+			for(size_t s = 0; s < streams.size(); s++)
+			{
+				OutputStream &stream = streams[s];
+				stream.selected = (!stream.finished
+								   && evaluate_selection(stream.selection, local_entry));
+				selected = selected || stream.selected;
+			}
+			stats.input_events++;
+			if(stats.enabled)
+			{
+				stats.select_timer.Stop();
+				stats.files.back().input_events++;
+			}
+			if(!selected)
+			{
+				continue;
+			}
+
+			//Read the entry.  This is only done once,
+			//however many streams select it, and skips the
+			//branches the selections have already read.
+			stats.selected_events++;
+			if(stats.enabled)
+			{
+				stats.files.back().selected_events++;
+				stats.read_timer.Start(kFALSE);
+			}
+			entry_reader.Read(i, local_entry);
+
+			//Compute the definitions before filtering any
+			//objects, since their formulas would read the
+			//unfiltered collections again
+			evaluate_defines(defines, streams, local_entry);
+			for(size_t o = 0; o < object_selections.size(); o++)
+			{
+				object_selections[o]->Evaluate();
+			}
+			for(size_t o = 0; o < object_selections.size(); o++)
+			{
+				object_selections[o]->Apply();
+			}
+			if(stats.enabled)
+			{
+				stats.read_timer.Stop();
+				stats.fill_timer.Start(kFALSE);
+			}
+
+			//Add it to the output tree of each stream which
+			//selected it
+			for(size_t s = 0; s < streams.size(); s++)
+			{
+				OutputStream &stream = streams[s];
+				if(!stream.selected)
+				{
+					continue;
+				}
+				stream.tree->Fill();
+				if(s == 0)
+				{
+					append_columnar_entry(columnar);
+				}
+				if(++stream.output_events == optimize_baskets_after)
+				{
+					stream.tree->OptimizeBaskets(optimize_baskets_memory);
+				}
+				if(stream.output_events == max_output_events)
+				{
+					stream.finished = true;
+					finished_streams++;
+				}
+			}
+			if(stats.enabled)
+			{
+				stats.fill_timer.Stop();
+			}
+		}
+		finish_progress(progress, stats.input_events, stats.selected_events);
+	}
+
+	//Save the output files and close
+	old_tree->SetNotify(NULL);
+	bool failed = (out_of_memory || read_error);
+	bool closed = close_output_streams(streams, !failed);
+	closed = close_columnar_output(columnar, !failed) && closed && !failed;
+	if(memory.enabled && !out_of_memory)
+	{
+		print_memory_report(memory, cout);
+	}
+
+	//Report statistics
+	finish_statistics(old_tree, stats);
+	for(size_t s = 0; s < streams.size(); s++)
+	{
+		stats.output_events += streams[s].output_events;
+	}
+	bool reported = report_statistics(options, stats);
+
+	//Clean up
+	delete_defines(defines);
+	release_input(old_tree, own_input);
+
+	return (closed && reported) ? 0 : 1;
+}
+
+
+}
+
+int run_skim(po::variables_map options, TChain *input_chain)
+{
+	//Restore anything global this skim changes on return
+	ProcessSettings process_settings;
+	if(options.count("verbose") == 0)
+	{
+		//Disable ROOT program output (well, only 
+		//print those things which are a break or 
+		//worse.)
+		gErrorIgnoreLevel = kBreak;
+	}
+	return skim(options, input_chain);
+}
+
+Skimmer::Skimmer()
+{
+}
+
+void Skimmer::Set(const string &name, const string &value)
+{
+	arguments.push_back("--" + name);
+	if(value.length() > 0)
+	{
+		arguments.push_back(value);
+	}
+}
+
+void Skimmer::Clear()
+{
+	arguments.clear();
+}
+
+bool Skimmer::Run() const
+{
+	//Parse the options exactly as the command line would be
+	po::variables_map options;
+	try
+	{
+		po::store(po::command_line_parser(arguments).options(get_skim_options()).run(), options);
+		po::notify(options);
+	}
+	catch(std::exception& e)
+	{
+		cerr << "ERROR: Couldn't parse the skim options: " << e.what() << endl;
+		return false;
+	}
+
+	return (run_skim(options) == 0);
+}
+
+}
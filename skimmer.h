@@ -0,0 +1,67 @@
+#ifndef PHYSICSTOOLS_SKIMMER_H
+#define PHYSICSTOOLS_SKIMMER_H
+
+//Standard includes
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT classes
+class TChain;
+
+namespace PhysicsTools
+{
+
+//The options understood by a skim, which are the skimslim
+//command line options
+boost::program_options::options_description get_skim_options();
+
+//Run a skim described by parsed options, returning 0 on
+//success (this is all of skimslim after option parsing).  An
+//input chain may be lent to the skim, in which case the input
+//options aren't used to create one, and the chain is left
+//open (with its branches reset) for the next skim.
+int run_skim(boost::program_options::variables_map options, TChain *input_chain = NULL);
+
+//Serve skim requests, with the serve options, until asked to
+//stop, returning 0 on success
+int run_skim_server(boost::program_options::variables_map options);
+
+//A skim configuration which can be run any number of times in
+//the same process, so that ROOT, its dictionaries and any
+//compiled selections are only loaded once.  Options are named
+//and given as on the skimslim command line, e.g.
+//
+//	PhysicsTools::Skimmer skimmer;
+//	skimmer.Set("input", "data.root");
+//	skimmer.Set("container", "physics");
+//	skimmer.Set("selection", "el_n > 0");
+//	skimmer.Set("replace");
+//	bool success = skimmer.Run();
+class Skimmer
+{
+	public:
+		Skimmer();
+
+		//Set an option, without its leading dashes.  Options
+		//which can be given more than once (e.g. selection)
+		//accumulate, others may only be set once.
+		void Set(const std::string &name, const std::string &value = "");
+
+		//Forget all options
+		void Clear();
+
+		//Run the skim, returning true on success.  Errors are
+		//reported on standard error, as by skimslim.
+		bool Run() const;
+
+	private:
+		std::vector<std::string> arguments;
+};
+
+}
+
+#endif
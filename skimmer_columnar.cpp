@@ -0,0 +1,702 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+
+//Boost includes
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+//ROOT includes
+#include <TChain.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TBranchElement.h>
+#include <TSystem.h>
+
+//PhysicsTools includes
+#include "skimmer_internal.h"
+#include "skimmer_columnar.h"
+
+#ifdef SKIMSLIM_WITH_ARROW
+//Arrow includes
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <parquet/arrow/writer.h>
+#endif
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespaces
+using namespace boost;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//The internals shared between the skimmer's sources
+using namespace PhysicsTools::Internal;
+
+#ifdef SKIMSLIM_WITH_ARROW
+
+namespace
+{
+
+//Appends the elements of a std::vector to the values of
+//a list column
+typedef arrow::Status (*VectorAppender)(void *, arrow::ArrayBuilder *);
+
+template<class T, class Builder, class Value>
+arrow::Status append_vector(void *object, arrow::ArrayBuilder *values)
+{
+	const vector<T> &elements = *(const vector<T> *)object;
+	Builder *builder = static_cast<Builder *>(values);
+	for(size_t i = 0; i < elements.size(); i++)
+	{
+		arrow::Status status = builder->Append((Value)elements[i]);
+		if(!status.ok())
+		{
+			return status;
+		}
+	}
+	return arrow::Status();
+}
+
+//How a column is filled
+enum ColumnSource
+{
+	COLUMN_LEAF,
+	COLUMN_VECTOR,
+	COLUMN_DEFINE
+};
+
+//One column of a columnar output
+struct ColumnarColumn
+{
+	string name;
+	ColumnSource source;
+	string branch_name;
+	string leaf_name;
+	TLeaf *leaf;
+	TBranchElement *branch;
+	VectorAppender appender;
+	const Double_t *define_value;
+	bool is_list;
+	arrow::Type::type type;
+	std::shared_ptr<arrow::ArrayBuilder> values;
+	std::shared_ptr<arrow::ListBuilder> list;
+};
+
+bool get_arrow_type(string type_name, arrow::Type::type &type)
+{
+	if(type_name == "Float_t" || type_name == "float" || type_name == "Float16_t")
+	{
+		type = arrow::Type::FLOAT;
+	}
+	else if(type_name == "Double_t" || type_name == "double" || type_name == "Double32_t")
+	{
+		type = arrow::Type::DOUBLE;
+	}
+	else if(type_name == "Bool_t" || type_name == "bool")
+	{
+		type = arrow::Type::BOOL;
+	}
+	else if(type_name == "UChar_t" || type_name == "unsigned char")
+	{
+		type = arrow::Type::UINT8;
+	}
+	else if(type_name == "UShort_t" || type_name == "unsigned short")
+	{
+		type = arrow::Type::UINT16;
+	}
+	else if(type_name == "UInt_t" || type_name == "unsigned int")
+	{
+		type = arrow::Type::UINT32;
+	}
+	else if(type_name == "ULong_t" || type_name == "unsigned long"
+			|| type_name == "ULong64_t" || type_name == "unsigned long long")
+	{
+		type = arrow::Type::UINT64;
+	}
+	else if(type_name == "Char_t" || type_name == "char"
+			|| type_name == "Short_t" || type_name == "short"
+			|| type_name == "Int_t" || type_name == "int"
+			|| type_name == "Long_t" || type_name == "long"
+			|| type_name == "Long64_t" || type_name == "long long")
+	{
+		type = arrow::Type::INT64;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+VectorAppender get_vector_appender(string class_name, arrow::Type::type &type)
+{
+	//Vectors are exported for the same element types they
+	//can be slimmed for
+	if(!starts_with(class_name, "vector<") || !ends_with(class_name, ">")
+	   || !get_arrow_type(class_name.substr(7, class_name.length() - 8), type))
+	{
+		return NULL;
+	}
+	if(class_name == "vector<float>") return append_vector<float, arrow::FloatBuilder, float>;
+	if(class_name == "vector<double>") return append_vector<double, arrow::DoubleBuilder, double>;
+	if(class_name == "vector<bool>") return append_vector<bool, arrow::BooleanBuilder, bool>;
+	if(class_name == "vector<int>") return append_vector<int, arrow::Int64Builder, int64_t>;
+	if(class_name == "vector<unsigned int>") return append_vector<unsigned int, arrow::UInt32Builder, uint32_t>;
+	if(class_name == "vector<short>") return append_vector<short, arrow::Int64Builder, int64_t>;
+	if(class_name == "vector<unsigned short>") return append_vector<unsigned short, arrow::UInt16Builder, uint16_t>;
+	if(class_name == "vector<char>") return append_vector<char, arrow::Int64Builder, int64_t>;
+	if(class_name == "vector<unsigned char>") return append_vector<unsigned char, arrow::UInt8Builder, uint8_t>;
+	if(class_name == "vector<long>") return append_vector<long, arrow::Int64Builder, int64_t>;
+	if(class_name == "vector<unsigned long>") return append_vector<unsigned long, arrow::UInt64Builder, uint64_t>;
+	if(class_name == "vector<Long64_t>" || class_name == "vector<long long>") return append_vector<Long64_t, arrow::Int64Builder, int64_t>;
+	if(class_name == "vector<ULong64_t>" || class_name == "vector<unsigned long long>") return append_vector<ULong64_t, arrow::UInt64Builder, uint64_t>;
+	return NULL;
+}
+
+std::shared_ptr<arrow::DataType> make_arrow_type(arrow::Type::type type)
+{
+	switch(type)
+	{
+		case arrow::Type::FLOAT:
+			return arrow::float32();
+		case arrow::Type::DOUBLE:
+			return arrow::float64();
+		case arrow::Type::BOOL:
+			return arrow::boolean();
+		case arrow::Type::UINT8:
+			return arrow::uint8();
+		case arrow::Type::UINT16:
+			return arrow::uint16();
+		case arrow::Type::UINT32:
+			return arrow::uint32();
+		case arrow::Type::UINT64:
+			return arrow::uint64();
+		default:
+			return arrow::int64();
+	}
+}
+
+std::shared_ptr<arrow::ArrayBuilder> make_arrow_builder(arrow::Type::type type)
+{
+	switch(type)
+	{
+		case arrow::Type::FLOAT:
+			return std::make_shared<arrow::FloatBuilder>();
+		case arrow::Type::DOUBLE:
+			return std::make_shared<arrow::DoubleBuilder>();
+		case arrow::Type::BOOL:
+			return std::make_shared<arrow::BooleanBuilder>();
+		case arrow::Type::UINT8:
+			return std::make_shared<arrow::UInt8Builder>();
+		case arrow::Type::UINT16:
+			return std::make_shared<arrow::UInt16Builder>();
+		case arrow::Type::UINT32:
+			return std::make_shared<arrow::UInt32Builder>();
+		case arrow::Type::UINT64:
+			return std::make_shared<arrow::UInt64Builder>();
+		default:
+			return std::make_shared<arrow::Int64Builder>();
+	}
+}
+
+}
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//Writes the selected entries of a chain as Arrow IPC or
+//Parquet, a batch (or row group) at a time, so that only
+//one batch is ever held in memory.  The columns are the
+//enabled leaves and vector branches which have a natural
+//Arrow type, and any definitions.  Leaves are looked up
+//again whenever the chain moves to a new tree.
+class ColumnarOutput : public TObject
+{
+	public:
+		ColumnarOutput(TChain *chain, const vector<ColumnarColumn> &columns, Long64_t batch_size) :
+			chain(chain),
+			columns(columns),
+			batch_size(batch_size),
+			rows(0),
+			failed(false)
+		{
+			vector< std::shared_ptr<arrow::Field> > fields;
+			vector<ColumnarColumn>::iterator column;
+			for(column = this->columns.begin();
+				column != this->columns.end();
+				column++)
+			{
+				column->values = make_arrow_builder(column->type);
+				std::shared_ptr<arrow::DataType> type = make_arrow_type(column->type);
+				if(column->is_list)
+				{
+					column->list = std::make_shared<arrow::ListBuilder>(arrow::default_memory_pool(), column->values);
+					type = arrow::list(type);
+				}
+				fields.push_back(arrow::field(column->name, type));
+			}
+			schema = arrow::schema(fields);
+			Notify();
+		}
+
+		std::shared_ptr<arrow::Schema> GetSchema() const
+		{
+			return schema;
+		}
+
+		bool Open(string path)
+		{
+			this->path = path;
+			arrow::Result< std::shared_ptr<arrow::io::FileOutputStream> > sink_result = arrow::io::FileOutputStream::Open(path);
+			if(!sink_result.ok())
+			{
+				return Fail(sink_result.status());
+			}
+			sink = *sink_result;
+			if(ends_with(path, ".parquet"))
+			{
+				arrow::Result< std::unique_ptr<parquet::arrow::FileWriter> > writer_result
+					= parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(), sink);
+				if(!writer_result.ok())
+				{
+					return Fail(writer_result.status());
+				}
+				parquet_writer = std::move(*writer_result);
+			}
+			else
+			{
+				arrow::Result< std::shared_ptr<arrow::ipc::RecordBatchWriter> > writer_result
+					= arrow::ipc::MakeFileWriter(sink, schema);
+				if(!writer_result.ok())
+				{
+					return Fail(writer_result.status());
+				}
+				ipc_writer = *writer_result;
+			}
+			return true;
+		}
+
+		Bool_t Notify()
+		{
+			TTree *tree = chain->GetTree();
+			if(tree == NULL)
+			{
+				return kTRUE;
+			}
+			vector<ColumnarColumn>::iterator column;
+			for(column = columns.begin();
+				column != columns.end();
+				column++)
+			{
+				if(column->source == COLUMN_LEAF)
+				{
+					TBranch *branch = tree->GetBranch(column->branch_name.c_str());
+					column->leaf = (branch != NULL) ? branch->GetLeaf(column->leaf_name.c_str()) : NULL;
+				}
+				else if(column->source == COLUMN_VECTOR)
+				{
+					column->branch = dynamic_cast<TBranchElement *>(tree->GetBranch(column->branch_name.c_str()));
+				}
+			}
+			return kTRUE;
+		}
+
+		void Append()
+		{
+			if(failed)
+			{
+				return;
+			}
+			vector<ColumnarColumn>::iterator column;
+			for(column = columns.begin();
+				column != columns.end() && !failed;
+				column++)
+			{
+				arrow::Status status;
+				if(column->is_list)
+				{
+					status = column->list->Append();
+				}
+				if(!status.ok())
+				{
+					Fail(status);
+				}
+				else if(column->source == COLUMN_DEFINE)
+				{
+					status = AppendValue(*column, *column->define_value, 0);
+				}
+				else if(column->source == COLUMN_VECTOR)
+				{
+					void *object = (column->branch != NULL) ? column->branch->GetObject() : NULL;
+					if(object != NULL)
+					{
+						status = column->appender(object, column->values.get());
+					}
+				}
+				else if(column->leaf != NULL)
+				{
+					Int_t n_values = column->is_list ? column->leaf->GetLen() : 1;
+					for(Int_t i = 0; i < n_values && status.ok(); i++)
+					{
+						status = AppendValue(*column, column->leaf->GetValue(i), column->leaf->GetValueLong64(i));
+					}
+				}
+				if(!status.ok())
+				{
+					Fail(status);
+				}
+			}
+			if(++rows == batch_size)
+			{
+				Flush();
+			}
+		}
+
+		bool Close()
+		{
+			Flush();
+			arrow::Status status;
+			if(parquet_writer)
+			{
+				status = parquet_writer->Close();
+			}
+			else if(ipc_writer)
+			{
+				status = ipc_writer->Close();
+			}
+			if(!status.ok())
+			{
+				Fail(status);
+			}
+			if(sink)
+			{
+				status = sink->Close();
+				if(!status.ok())
+				{
+					Fail(status);
+				}
+			}
+			return !failed;
+		}
+
+		void Discard()
+		{
+			//Close the file without writing the buffered rows
+			//or the footer, and remove it
+			if(sink)
+			{
+				arrow::Status status = sink->Close();
+				if(!status.ok())
+				{
+					cerr << "WARNING: Unable to close the columnar output: " << status.ToString() << endl;
+				}
+			}
+			if(path.length() > 0)
+			{
+				gSystem->Unlink(path.c_str());
+			}
+		}
+
+	private:
+		arrow::Status AppendValue(ColumnarColumn &column, Double_t value, Long64_t integer_value)
+		{
+			switch(column.type)
+			{
+				case arrow::Type::FLOAT:
+					return static_cast<arrow::FloatBuilder *>(column.values.get())->Append((float)value);
+				case arrow::Type::DOUBLE:
+					return static_cast<arrow::DoubleBuilder *>(column.values.get())->Append(value);
+				case arrow::Type::BOOL:
+					return static_cast<arrow::BooleanBuilder *>(column.values.get())->Append(value != 0);
+				//Unsigned leaves keep their bits in the 64 bit
+				//integer value
+				case arrow::Type::UINT8:
+					return static_cast<arrow::UInt8Builder *>(column.values.get())->Append((uint8_t)integer_value);
+				case arrow::Type::UINT16:
+					return static_cast<arrow::UInt16Builder *>(column.values.get())->Append((uint16_t)integer_value);
+				case arrow::Type::UINT32:
+					return static_cast<arrow::UInt32Builder *>(column.values.get())->Append((uint32_t)integer_value);
+				case arrow::Type::UINT64:
+					return static_cast<arrow::UInt64Builder *>(column.values.get())->Append((uint64_t)integer_value);
+				default:
+					return static_cast<arrow::Int64Builder *>(column.values.get())->Append(integer_value);
+			}
+		}
+
+		void Flush()
+		{
+			if(failed || rows == 0)
+			{
+				return;
+			}
+
+			//Finish the batch, which resets the builders for
+			//the next one
+			vector< std::shared_ptr<arrow::Array> > arrays(columns.size());
+			for(size_t c = 0; c < columns.size() && !failed; c++)
+			{
+				arrow::ArrayBuilder *builder = columns[c].is_list
+											   ? (arrow::ArrayBuilder *)columns[c].list.get()
+											   : columns[c].values.get();
+				arrow::Status status = builder->Finish(&arrays[c]);
+				if(!status.ok())
+				{
+					Fail(status);
+				}
+			}
+			if(failed)
+			{
+				return;
+			}
+			std::shared_ptr<arrow::RecordBatch> batch = arrow::RecordBatch::Make(schema, rows, arrays);
+			rows = 0;
+
+			//Write it, as a row group of its own for Parquet
+			arrow::Status status;
+			if(parquet_writer)
+			{
+				vector< std::shared_ptr<arrow::RecordBatch> > batches(1, batch);
+				arrow::Result< std::shared_ptr<arrow::Table> > table = arrow::Table::FromRecordBatches(batches);
+				status = table.ok() ? parquet_writer->WriteTable(**table, batch_size) : table.status();
+			}
+			else if(ipc_writer)
+			{
+				status = ipc_writer->WriteRecordBatch(*batch);
+			}
+			if(!status.ok())
+			{
+				Fail(status);
+			}
+		}
+
+		bool Fail(const arrow::Status &status)
+		{
+			cerr << "ERROR: Unable to write the columnar output: " << status.ToString() << endl;
+			failed = true;
+			return false;
+		}
+
+		TChain *chain;
+		vector<ColumnarColumn> columns;
+		Long64_t batch_size;
+		Long64_t rows;
+		bool failed;
+		string path;
+		std::shared_ptr<arrow::Schema> schema;
+		std::shared_ptr<arrow::io::FileOutputStream> sink;
+		std::shared_ptr<arrow::ipc::RecordBatchWriter> ipc_writer;
+		std::unique_ptr<parquet::arrow::FileWriter> parquet_writer;
+};
+
+bool open_columnar_output_from_options(po::variables_map options,
+									   TChain *chain,
+									   vector<Define> &defines,
+									   ColumnarOutput *&columnar)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	columnar = NULL;
+	if(options.count("columnar-output") == 0)
+	{
+		return true;
+	}
+	bool replace = (options.count("replace") > 0);
+	string path = options["columnar-output"].as<string>();
+	Long64_t batch_size = options["row-group-size"].as<Long64_t>();
+	if(batch_size <= 0)
+	{
+		cerr << "ERROR: Row group size must be > 0 to make sense" << endl;
+		return false;
+	}
+	if(!replace && !gSystem->AccessPathName(path.c_str()))
+	{
+		cerr << "ERROR: Unable to open the columnar output file (" << path << ") for writing." << endl;
+		return false;
+	}
+
+	//Find the columns among the enabled branches
+	vector<ColumnarColumn> columns;
+	TTree *tree = chain->GetTree();
+	TObjArray *leaves = tree->GetListOfLeaves();
+	set<string> vector_branches;
+	for(Int_t l = 0; l < leaves->GetEntriesFast(); l++)
+	{
+		TLeaf *leaf = (TLeaf *)leaves->UncheckedAt(l);
+		TBranch *branch = leaf->GetBranch();
+		if(branch->TestBit(kDoNotProcess))
+		{
+			continue;
+		}
+		ColumnarColumn column;
+		column.branch_name = branch->GetName();
+		column.leaf_name = leaf->GetName();
+		column.leaf = NULL;
+		column.branch = NULL;
+		column.appender = NULL;
+		column.define_value = NULL;
+		TBranchElement *element = dynamic_cast<TBranchElement *>(branch);
+		if(element != NULL)
+		{
+			//Only whole vectors of simple types have an
+			//obvious Arrow equivalent
+			column.appender = get_vector_appender(element->GetClassName(), column.type);
+			if(column.appender == NULL || element->GetMother() != element)
+			{
+				cerr << "WARNING: " << column.branch_name << " (" << element->GetClassName()
+					 << ") can't be written as a column, skipping it." << endl;
+				continue;
+			}
+			if(!vector_branches.insert(column.branch_name).second)
+			{
+				continue;
+			}
+			column.name = column.branch_name;
+			column.source = COLUMN_VECTOR;
+			column.is_list = true;
+		}
+		else
+		{
+			if(!get_arrow_type(leaf->GetTypeName(), column.type))
+			{
+				cerr << "WARNING: " << column.leaf_name << " (" << leaf->GetTypeName()
+					 << ") can't be written as a column, skipping it." << endl;
+				continue;
+			}
+			column.name = (branch->GetNleaves() == 1) ? column.branch_name : column.branch_name + "." + column.leaf_name;
+			column.source = COLUMN_LEAF;
+			column.is_list = (leaf->GetLeafCount() != NULL || leaf->GetLenStatic() != 1);
+		}
+		columns.push_back(column);
+	}
+	vector<Define>::iterator define;
+	for(define = defines.begin();
+		define != defines.end();
+		define++)
+	{
+		ColumnarColumn column;
+		column.name = define->name;
+		column.source = COLUMN_DEFINE;
+		column.leaf = NULL;
+		column.branch = NULL;
+		column.appender = NULL;
+		column.define_value = &define->value;
+		column.is_list = false;
+		column.type = arrow::Type::DOUBLE;
+		columns.push_back(column);
+	}
+
+	if(verbose)
+	{
+		cout << "Writing " << columns.size() << " columns to " << path
+			 << " in batches of " << batch_size << " entries" << endl;
+	}
+	columnar = new ColumnarOutput(chain, columns, batch_size);
+	if(!columnar->Open(path))
+	{
+		delete columnar;
+		columnar = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void append_columnar_entry(ColumnarOutput *columnar)
+{
+	if(columnar != NULL)
+	{
+		columnar->Append();
+	}
+}
+
+void add_columnar_to_notifier(ColumnarOutput *columnar, ChainNotifier &notifier)
+{
+	if(columnar != NULL)
+	{
+		notifier.Add(columnar);
+	}
+}
+
+bool close_columnar_output(ColumnarOutput *columnar, bool write)
+{
+	if(columnar == NULL)
+	{
+		return true;
+	}
+	bool closed = true;
+	if(write)
+	{
+		closed = columnar->Close();
+	}
+	else
+	{
+		columnar->Discard();
+	}
+	delete columnar;
+	return closed;
+}
+
+}
+
+}
+
+#else
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//Without Arrow, there is no columnar output
+class ColumnarOutput : public TObject
+{
+};
+
+bool open_columnar_output_from_options(po::variables_map options,
+									   TChain *chain,
+									   vector<Define> &defines,
+									   ColumnarOutput *&columnar)
+{
+	columnar = NULL;
+	if(options.count("columnar-output") > 0)
+	{
+		cerr << "ERROR: This skimslim was built without Arrow, which is needed for --columnar-output" << endl;
+		return false;
+	}
+	return true;
+}
+
+void append_columnar_entry(ColumnarOutput *columnar)
+{
+}
+
+void add_columnar_to_notifier(ColumnarOutput *columnar, ChainNotifier &notifier)
+{
+	if(columnar != NULL)
+	{
+		notifier.Add(columnar);
+	}
+}
+
+bool close_columnar_output(ColumnarOutput *columnar, bool write)
+{
+	delete columnar;
+	return true;
+}
+}
+
+}
+
+#endif
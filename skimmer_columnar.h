@@ -0,0 +1,47 @@
+#ifndef PHYSICSTOOLS_SKIMMER_COLUMNAR_H
+#define PHYSICSTOOLS_SKIMMER_COLUMNAR_H
+
+//Standard includes
+#include <vector>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TChain.h>
+
+//PhysicsTools includes
+#include "skimmer_internal.h"
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//Writes the selected entries as Arrow IPC or Parquet (when
+//built with Arrow)
+class ColumnarOutput;
+
+//Open the columnar output given by the options, if any,
+//leaving it NULL if there is none
+bool open_columnar_output_from_options(boost::program_options::variables_map options,
+									   TChain *chain,
+									   std::vector<Define> &defines,
+									   ColumnarOutput *&columnar);
+
+//Have the columnar output (if any) look up its leaves again
+//when the chain moves to a new tree
+void add_columnar_to_notifier(ColumnarOutput *columnar, ChainNotifier &notifier);
+
+//Add the current entry to the columnar output, if any
+void append_columnar_entry(ColumnarOutput *columnar);
+
+//Write (or discard) and delete the columnar output, if any
+bool close_columnar_output(ColumnarOutput *columnar, bool write);
+
+}
+
+}
+
+#endif
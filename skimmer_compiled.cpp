@@ -0,0 +1,322 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+
+//Boost includes
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+//ROOT includes
+#include <TTree.h>
+#include <TTreeFormula.h>
+#include <TLeaf.h>
+#include <TSystem.h>
+#include <TMD5.h>
+
+//PhysicsTools includes
+#include "skimmer_internal.h"
+#include "skimmer_compiled.h"
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//The internals shared between the skimmer's sources
+using namespace PhysicsTools::Internal;
+
+namespace
+{
+
+//Functions a compiled selection may call, which TTreeFormula
+//and C++ (with cmath and TMath) evaluate the same way
+const char *COMPILED_SELECTION_FUNCTIONS[] = {"sqrt", "abs", "fabs", "exp", "log", "log10", "pow",
+											  "sin", "cos", "tan", "asin", "acos", "atan", "atan2",
+											  "sinh", "cosh", "tanh", "min", "max",
+											  "TMath::Abs", "TMath::Sqrt", "TMath::Exp", "TMath::Log",
+											  "TMath::Log10", "TMath::Power", "TMath::Sin", "TMath::Cos",
+											  "TMath::Tan", "TMath::ASin", "TMath::ACos", "TMath::ATan",
+											  "TMath::ATan2", "TMath::Pi", "TMath::Hypot", "TMath::Min",
+											  "TMath::Max"};
+
+bool translate_selection(const string &selection, const vector<string> &leaf_names, string &translated)
+{
+	//Rewrite a TTreeFormula expression as C++ which means
+	//the same thing.  Only a small grammar, on which the two
+	//are known to agree, is accepted: leaves, the functions
+	//above, numbers, and the arithmetic, comparison and
+	//logical operators.  Every number is written as a
+	//double, since TTreeFormula does all its arithmetic in
+	//double (so 3/2 is 1.5, not 1).
+	set<string> functions(COMPILED_SELECTION_FUNCTIONS,
+						  COMPILED_SELECTION_FUNCTIONS + sizeof(COMPILED_SELECTION_FUNCTIONS) / sizeof(const char *));
+	ostringstream output;
+	size_t length = selection.length();
+	size_t i = 0;
+	while(i < length)
+	{
+		char c = selection[i];
+		size_t end = i + 1;
+		if(isspace(c))
+		{
+			output << c;
+		}
+		else if(isalpha(c) || c == '_')
+		{
+			//A leaf or function name, which may be qualified
+			while(end < length)
+			{
+				if(isalnum(selection[end]) || selection[end] == '_')
+				{
+					end++;
+				}
+				else if(selection.compare(end, 2, "::") == 0)
+				{
+					end += 2;
+				}
+				else
+				{
+					break;
+				}
+			}
+			string name = selection.substr(i, end - i);
+			if(find(leaf_names.begin(), leaf_names.end(), name) == leaf_names.end()
+			   && functions.count(name) == 0)
+			{
+				cerr << "WARNING: Selection uses " << name << ", which can't be compiled, it won't be compiled." << endl;
+				return false;
+			}
+			output << name;
+		}
+		else if(isdigit(c) || (c == '.' && i + 1 < length && isdigit(selection[i + 1])))
+		{
+			//A decimal number, with an optional fraction and
+			//exponent (hexadecimal and suffixes aren't
+			//accepted)
+			bool integer = (c != '.');
+			while(end < length && isdigit(selection[end]))
+			{
+				end++;
+			}
+			if(integer && end < length && selection[end] == '.')
+			{
+				integer = false;
+				end++;
+				while(end < length && isdigit(selection[end]))
+				{
+					end++;
+				}
+			}
+			if(end < length && (selection[end] == 'e' || selection[end] == 'E'))
+			{
+				integer = false;
+				end++;
+				if(end < length && (selection[end] == '+' || selection[end] == '-'))
+				{
+					end++;
+				}
+				if(end == length || !isdigit(selection[end]))
+				{
+					cerr << "WARNING: Selection has a malformed number, it won't be compiled." << endl;
+					return false;
+				}
+				while(end < length && isdigit(selection[end]))
+				{
+					end++;
+				}
+			}
+			if(end < length && (isalnum(selection[end]) || selection[end] == '_' || selection[end] == '.'))
+			{
+				cerr << "WARNING: Selection has a number which can't be compiled, it won't be compiled." << endl;
+				return false;
+			}
+			output << selection.substr(i, end - i);
+			if(integer)
+			{
+				output << ".0";
+			}
+		}
+		else if(selection.compare(i, 2, "<=") == 0 || selection.compare(i, 2, ">=") == 0
+				|| selection.compare(i, 2, "==") == 0 || selection.compare(i, 2, "!=") == 0
+				|| selection.compare(i, 2, "&&") == 0 || selection.compare(i, 2, "||") == 0)
+		{
+			end = i + 2;
+			output << selection.substr(i, 2);
+		}
+		else if(string("+-*/(),<>!").find(c) != string::npos)
+		{
+			output << c;
+		}
+		else
+		{
+			cerr << "WARNING: Selection uses '" << c << "', which can't be compiled, it won't be compiled." << endl;
+			return false;
+		}
+		i = end;
+	}
+	translated = output.str();
+	return true;
+}
+
+//Held while a selection is compiled and loaded
+boost::mutex compile_mutex;
+
+}
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+CompiledSelectionFunction compile_selection(po::variables_map options,
+											TTreeFormula *formula,
+											vector<string> &leaf_names,
+											CompiledBatchFunction &batch_function)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string cache_directory = options["compile-cache-dir"].as<string>();
+	string selection = formula->GetTitle();
+
+	//Only selections on scalar leaves, which can be
+	//referred to by name in C++, can be compiled
+	if(formula->GetMultiplicity() != 0)
+	{
+		cerr << "WARNING: Selection uses arrays, it won't be compiled." << endl;
+		return NULL;
+	}
+	leaf_names.clear();
+	for(Int_t i = 0; i < formula->GetNcodes(); i++)
+	{
+		TLeaf *leaf = formula->GetLeaf(i);
+		if(leaf == NULL
+		   || leaf->GetLeafCount() != NULL
+		   || leaf->GetLenStatic() != 1
+		   || !is_identifier(leaf->GetName()))
+		{
+			cerr << "WARNING: Selection uses a leaf which can't be compiled, it won't be compiled." << endl;
+			return NULL;
+		}
+		if(find(leaf_names.begin(), leaf_names.end(), leaf->GetName()) == leaf_names.end())
+		{
+			leaf_names.push_back(leaf->GetName());
+		}
+	}
+	string translated;
+	if(!translate_selection(selection, leaf_names, translated))
+	{
+		return NULL;
+	}
+
+	//Generate the function bodies, for a single entry and
+	//for a batch.  The batch loop only touches contiguous
+	//arrays, so the compiler can vectorize it.  The function
+	//names are a hash of everything that goes into them, so
+	//a compiled library can be reused by any later skim with
+	//the same selection.
+	ostringstream body;
+	body << "(const double *skimslim_values)" << endl;
+	body << "{" << endl;
+	for(size_t i = 0; i < leaf_names.size(); i++)
+	{
+		body << "\tconst double " << leaf_names[i] << " = skimslim_values[" << i << "];" << endl;
+	}
+	body << "\treturn (" << translated << ");" << endl;
+	body << "}" << endl;
+	ostringstream batch_body;
+	batch_body << "(const double * const *skimslim_columns, long long skimslim_n, unsigned char *skimslim_mask)" << endl;
+	batch_body << "{" << endl;
+	batch_body << "\tfor(long long skimslim_i = 0; skimslim_i < skimslim_n; skimslim_i++)" << endl;
+	batch_body << "\t{" << endl;
+	for(size_t i = 0; i < leaf_names.size(); i++)
+	{
+		batch_body << "\t\tconst double " << leaf_names[i] << " = skimslim_columns[" << i << "][skimslim_i];" << endl;
+	}
+	batch_body << "\t\tskimslim_mask[skimslim_i] = ((" << translated << ") != 0);" << endl;
+	batch_body << "\t}" << endl;
+	batch_body << "}" << endl;
+	string bodies = body.str() + batch_body.str();
+	TMD5 md5;
+	md5.Update((const UChar_t *)bodies.c_str(), bodies.length());
+	md5.Final();
+	string function_name = string("skimslim_selection_") + md5.AsString();
+	string batch_function_name = function_name + "_batch";
+
+	//Skims running at the same time in a server compile one
+	//at a time, so that they don't write or build the same
+	//library at once
+	boost::mutex::scoped_lock lock(compile_mutex);
+
+	//In a long-lived process, an earlier skim may already
+	//have loaded the library
+	CompiledSelectionFunction function = (CompiledSelectionFunction)gSystem->DynFindSymbol("*", function_name.c_str());
+	if(function != NULL)
+	{
+		batch_function = (CompiledBatchFunction)gSystem->DynFindSymbol("*", batch_function_name.c_str());
+		return function;
+	}
+
+	//Write the source, unless it's already there (rewriting
+	//it would make ACLiC rebuild the library).  It's written
+	//beside its final name and then moved there, so another
+	//process sharing the cache never sees half of it.
+	gSystem->mkdir(cache_directory.c_str(), kTRUE);
+	string source_path = cache_directory + "/" + function_name + ".C";
+	if(gSystem->AccessPathName(source_path.c_str()))
+	{
+		ostringstream temporary_path;
+		temporary_path << source_path << "." << gSystem->GetPid() << ".tmp";
+		ofstream source(temporary_path.str().c_str());
+		if(!source.is_open())
+		{
+			cerr << "WARNING: Unable to write the compiled selection source (" << temporary_path.str() << ")." << endl;
+			return NULL;
+		}
+		source << "//Generated by skimslim for the selection:" << endl;
+		source << "//" << selection << endl;
+		source << "#include <cmath>" << endl;
+		source << "#include <cstdlib>" << endl;
+		source << "#include <TMath.h>" << endl;
+		source << "using namespace std;" << endl;
+		source << "extern \"C\" double " << function_name << body.str();
+		source << "extern \"C\" void " << batch_function_name << batch_body.str();
+		source.close();
+		if(source.fail() || gSystem->Rename(temporary_path.str().c_str(), source_path.c_str()) != 0)
+		{
+			cerr << "WARNING: Unable to write the compiled selection source (" << source_path << ")." << endl;
+			gSystem->Unlink(temporary_path.str().c_str());
+			return NULL;
+		}
+	}
+
+	//Compile (or just load, if it's up to date) and find
+	//the function
+	if(verbose)
+	{
+		cout << "Compiling selection: " << source_path << endl;
+	}
+	if(!gSystem->CompileMacro(source_path.c_str(), "kO", "", cache_directory.c_str()))
+	{
+		cerr << "WARNING: Unable to compile the selection." << endl;
+		return NULL;
+	}
+	function = (CompiledSelectionFunction)gSystem->DynFindSymbol("*", function_name.c_str());
+	batch_function = (CompiledBatchFunction)gSystem->DynFindSymbol("*", batch_function_name.c_str());
+	if(function == NULL)
+	{
+		cerr << "WARNING: Unable to load the compiled selection." << endl;
+	}
+
+	return function;
+}
+}
+
+}
@@ -0,0 +1,269 @@
+#ifndef PHYSICSTOOLS_SKIMMER_COMPILED_H
+#define PHYSICSTOOLS_SKIMMER_COMPILED_H
+
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TObject.h>
+#include <TTree.h>
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TTreeFormula.h>
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//Number of entries for which a compiled selection is
+//checked against the TTreeFormula it replaces
+const int COMPILED_SELECTION_VERIFY_ENTRIES = 1000;
+
+//Relative difference allowed between a compiled
+//expression and the TTreeFormula it replaces
+const double COMPILED_VALUE_TOLERANCE = 1e-9;
+
+//Signature of a compiled selection, which takes the
+//values of the leaves it reads in order
+typedef Double_t (*CompiledSelectionFunction)(const Double_t *);
+
+//Signature of a compiled selection evaluated over a batch
+//of entries, which takes one contiguous column of values
+//per leaf and sets one mask byte per entry
+typedef void (*CompiledBatchFunction)(const Double_t * const *, Long64_t, unsigned char *);
+
+//A selection compiled to native code, bound to the leaves
+//of a chain.  The leaves are looked up again whenever the
+//chain moves to a new tree.  If a batch size is given,
+//the leaves are read a column at a time for a batch of
+//entries, and the batch is evaluated in one call, with
+//results handed out as the entries are asked for.  (The
+//reading is still entry by entry through the branch, it's
+//the evaluation that is batched.)  Batches stop at the end
+//of the tree and at the end entry of the skim, if set.
+class CompiledSelection : public TObject
+{
+	public:
+		CompiledSelection(CompiledSelectionFunction function,
+						  CompiledBatchFunction batch_function,
+						  const std::vector<std::string> &leaf_names,
+						  TTree *tree,
+						  Long64_t batch_size) :
+			function(function),
+			batch_function(batch_function),
+			leaf_names(leaf_names),
+			leaves(leaf_names.size(), (TLeaf *)NULL),
+			values(leaf_names.size(), 0.0),
+			tree(tree),
+			batch_size(batch_function != NULL ? batch_size : 0),
+			batch_first(0),
+			batch_end(0),
+			end_entry(-1),
+			verify_entries(COMPILED_SELECTION_VERIFY_ENTRIES),
+			active(true)
+		{
+			if(this->batch_size > 0)
+			{
+				columns.resize(leaf_names.size(), std::vector<Double_t>(this->batch_size));
+				column_pointers.resize(leaf_names.size());
+				for(size_t i = 0; i < columns.size(); i++)
+				{
+					column_pointers[i] = &columns[i][0];
+				}
+				mask.resize(this->batch_size);
+			}
+			Notify();
+		}
+
+		CompiledSelection * Bind(TTree *other_tree) const
+		{
+			return new CompiledSelection(function, batch_function, leaf_names, other_tree, batch_size);
+		}
+
+		//Set the entry (of the chain) at which evaluation
+		//stops, so that batches don't read past it
+		void SetEndEntry(Long64_t entry)
+		{
+			end_entry = entry;
+			batch_first = 0;
+			batch_end = 0;
+		}
+
+		Bool_t Notify()
+		{
+			for(size_t i = 0; i < leaf_names.size(); i++)
+			{
+				leaves[i] = tree->GetLeaf(leaf_names[i].c_str());
+				if(leaves[i] == NULL)
+				{
+					//Let TTreeFormula deal with it
+					active = false;
+				}
+			}
+
+			//Any batch belonged to the previous tree
+			batch_first = 0;
+			batch_end = 0;
+			return kTRUE;
+		}
+
+		inline bool Select(TTreeFormula *formula, Long64_t local_entry)
+		{
+			if(!active)
+			{
+				return formula->EvalInstance(0) != 0;
+			}
+
+			//Evaluate, either from the current batch (starting
+			//a new one if needed) or for this entry alone
+			bool result = false;
+			if(batch_size > 0)
+			{
+				if(local_entry < batch_first || local_entry >= batch_end)
+				{
+					EvaluateBatch(local_entry);
+				}
+				result = (mask[local_entry - batch_first] != 0);
+			}
+			else
+			{
+				result = (Call(local_entry) != 0);
+			}
+
+			//The compiled expression is translated to mean
+			//the same as the formula, but check that it agrees
+			//for the first few entries, in case of differences
+			//in the functions or their rounding
+			if(verify_entries > 0)
+			{
+				verify_entries--;
+				if(batch_size > 0)
+				{
+					//Reading the batch left the branches on its
+					//last entry
+					for(size_t i = 0; i < leaves.size(); i++)
+					{
+						leaves[i]->GetBranch()->GetEntry(local_entry);
+					}
+				}
+				bool expected = (formula->EvalInstance(0) != 0);
+				if(result != expected)
+				{
+					std::cerr << "WARNING: Compiled selection disagrees with TTreeFormula,"
+						 << " falling back to the interpreted selection." << std::endl;
+					active = false;
+					return expected;
+				}
+			}
+
+			return result;
+		}
+
+		inline Double_t Evaluate(TTreeFormula *formula, Long64_t local_entry)
+		{
+			if(!active)
+			{
+				return formula->EvalInstance(0);
+			}
+			Double_t result = Call(local_entry);
+
+			//Check the first few values against the formula,
+			//as for a selection
+			if(verify_entries > 0)
+			{
+				verify_entries--;
+				Double_t expected = formula->EvalInstance(0);
+				if(std::fabs(result - expected) > COMPILED_VALUE_TOLERANCE * std::max(std::fabs(result), std::fabs(expected)))
+				{
+					std::cerr << "WARNING: Compiled expression disagrees with TTreeFormula,"
+						 << " falling back to the interpreted expression." << std::endl;
+					active = false;
+					return expected;
+				}
+			}
+
+			return result;
+		}
+
+	private:
+		inline Double_t Call(Long64_t local_entry)
+		{
+			for(size_t i = 0; i < leaves.size(); i++)
+			{
+				leaves[i]->GetBranch()->GetEntry(local_entry);
+				values[i] = leaves[i]->GetValue(0);
+			}
+			return function(values.empty() ? NULL : &values[0]);
+		}
+
+		void EvaluateBatch(Long64_t first_entry)
+		{
+			//Batches don't cross into the next tree, or past
+			//the end of the skim
+			Long64_t n = std::min(batch_size, tree->GetTree()->GetEntries() - first_entry);
+			if(end_entry >= 0)
+			{
+				n = std::min(n, end_entry - tree->GetTree()->GetChainOffset() - first_entry);
+			}
+
+			//Read each leaf's column in turn, so each branch's
+			//baskets are walked through sequentially
+			for(size_t i = 0; i < leaves.size(); i++)
+			{
+				TLeaf *leaf = leaves[i];
+				TBranch *branch = leaf->GetBranch();
+				Double_t *column = &columns[i][0];
+				for(Long64_t e = 0; e < n; e++)
+				{
+					branch->GetEntry(first_entry + e);
+					column[e] = leaf->GetValue(0);
+				}
+			}
+
+			batch_function(column_pointers.empty() ? NULL : &column_pointers[0], n, &mask[0]);
+			batch_first = first_entry;
+			batch_end = first_entry + n;
+		}
+
+		CompiledSelectionFunction function;
+		CompiledBatchFunction batch_function;
+		std::vector<std::string> leaf_names;
+		std::vector<TLeaf *> leaves;
+		std::vector<Double_t> values;
+		TTree *tree;
+		Long64_t batch_size;
+		Long64_t batch_first;
+		Long64_t batch_end;
+		Long64_t end_entry;
+		std::vector< std::vector<Double_t> > columns;
+		std::vector<const Double_t *> column_pointers;
+		std::vector<unsigned char> mask;
+		int verify_entries;
+		bool active;
+};
+
+
+//Compile a selection (or any expression) to native code,
+//returning NULL if it can't be, in which case the formula
+//should be used.  The leaves it reads, in the order the
+//compiled function takes them, are returned, and the
+//batch function is set if one could be compiled too.
+CompiledSelectionFunction compile_selection(boost::program_options::variables_map options,
+											TTreeFormula *formula,
+											std::vector<std::string> &leaf_names,
+											CompiledBatchFunction &batch_function);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,498 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cfloat>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TFile.h>
+#include <TChain.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TSystem.h>
+#include <TMD5.h>
+#include <TEntryList.h>
+
+//PhysicsTools includes
+#include "skimmer_internal.h"
+#include "skimmer_index.h"
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//The internals shared between the skimmer's sources
+using namespace PhysicsTools::Internal;
+
+namespace
+{
+
+//The range of each indexed branch within one cluster of
+//an input file
+struct IndexedCluster
+{
+	Long64_t first_entry;
+	Long64_t end_entry;
+	vector<BranchRange> ranges;
+};
+
+//The indexed clusters of one input file, which is
+//identified by its name, entry count and (where it can be
+//found) size and modification time, or -1 for those
+struct IndexedFile
+{
+	string name;
+	Long64_t entries;
+	Long64_t size;
+	Long_t modified;
+	vector<IndexedCluster> clusters;
+};
+
+void get_file_identity(const char *name, Long64_t &size, Long_t &modified)
+{
+	size = -1;
+	modified = -1;
+	FileStat_t file_stat;
+	if(gSystem->GetPathInfo(name, file_stat) == 0)
+	{
+		size = file_stat.fSize;
+		modified = file_stat.fMtime;
+	}
+}
+
+bool build_cluster_index(TChain *chain, const vector<string> &branches, vector<IndexedFile> &files)
+{
+	//Index each tree of the chain, a cluster at a time
+	files.clear();
+	TObjArray *elements = chain->GetListOfFiles();
+	for(Int_t t = 0; t < chain->GetNtrees(); t++)
+	{
+		chain->LoadTree(chain->GetTreeOffset()[t]);
+		TTree *tree = chain->GetTree();
+
+		//Only scalars have a single range per entry
+		vector<TLeaf *> leaves;
+		vector<string>::const_iterator branch;
+		for(branch = branches.begin();
+			branch != branches.end();
+			branch++)
+		{
+			TLeaf *leaf = tree->GetLeaf(branch->c_str());
+			if(leaf == NULL || leaf->GetLeafCount() != NULL || leaf->GetLenStatic() != 1)
+			{
+				cerr << "ERROR: Only scalar branches can be indexed: " << *branch << endl;
+				return false;
+			}
+			leaves.push_back(leaf);
+		}
+
+		IndexedFile file;
+		file.name = elements->At(t)->GetTitle();
+		file.entries = tree->GetEntries();
+		get_file_identity(file.name.c_str(), file.size, file.modified);
+		TTree::TClusterIterator cluster_iterator = tree->GetClusterIterator(0);
+		Long64_t first_entry;
+		while((first_entry = cluster_iterator()) < file.entries)
+		{
+			IndexedCluster cluster;
+			cluster.first_entry = first_entry;
+			cluster.end_entry = min(cluster_iterator.GetNextEntry(), file.entries);
+			cluster.ranges.resize(leaves.size());
+			for(size_t l = 0; l < leaves.size(); l++)
+			{
+				//Read even if the branch is disabled for
+				//the output.  NaN passes no cut, so it
+				//doesn't widen the range, but a cluster of
+				//only NaN is given the widest range rather
+				//than relying on that.
+				BranchRange &range = cluster.ranges[l];
+				TBranch *leaf_branch = leaves[l]->GetBranch();
+				bool found = false;
+				for(Long64_t e = cluster.first_entry; e < cluster.end_entry; e++)
+				{
+					leaf_branch->GetEntry(e, 1);
+					double value = leaves[l]->GetValue(0);
+					if(std::isnan(value))
+					{
+						continue;
+					}
+					if(!found || value < range.minimum)
+					{
+						range.minimum = value;
+					}
+					if(!found || value > range.maximum)
+					{
+						range.maximum = value;
+					}
+					found = true;
+				}
+				if(!found)
+				{
+					range.minimum = -DBL_MAX;
+					range.maximum = DBL_MAX;
+				}
+			}
+			file.clusters.push_back(cluster);
+		}
+		files.push_back(file);
+	}
+
+	return true;
+}
+
+bool write_cluster_index(string path, const vector<string> &branches, const vector<IndexedFile> &files)
+{
+	ofstream out(path.c_str());
+	if(!out.is_open())
+	{
+		cerr << "ERROR: Unable to open the cluster index (" << path << ") for writing." << endl;
+		return false;
+	}
+
+	//Write full precision, so that ranges are exact
+	out.precision(17);
+	out << "#skimslim cluster index" << endl;
+	out << "branches";
+	for(size_t b = 0; b < branches.size(); b++)
+	{
+		out << " " << branches[b];
+	}
+	out << endl;
+	vector<IndexedFile>::const_iterator file;
+	for(file = files.begin();
+		file != files.end();
+		file++)
+	{
+		out << "file " << file->name << " " << file->entries
+			<< " " << file->size << " " << file->modified << endl;
+		vector<IndexedCluster>::const_iterator cluster;
+		for(cluster = file->clusters.begin();
+			cluster != file->clusters.end();
+			cluster++)
+		{
+			out << "cluster " << cluster->first_entry << " " << cluster->end_entry;
+			for(size_t b = 0; b < cluster->ranges.size(); b++)
+			{
+				out << " " << cluster->ranges[b].minimum << " " << cluster->ranges[b].maximum;
+			}
+			out << endl;
+		}
+	}
+
+	return out.good();
+}
+
+bool read_cluster_index(string path, vector<string> &branches, vector<IndexedFile> &files)
+{
+	ifstream in(path.c_str());
+	if(!in.is_open())
+	{
+		return false;
+	}
+
+	branches.clear();
+	files.clear();
+	string line;
+	while(getline(in, line))
+	{
+		if(line.length() == 0 || line[0] == '#')
+		{
+			continue;
+		}
+		istringstream fields(line);
+		string type;
+		fields >> type;
+		if(type == "branches")
+		{
+			string branch;
+			while(fields >> branch)
+			{
+				branches.push_back(branch);
+			}
+		}
+		else if(type == "file")
+		{
+			IndexedFile file;
+			fields >> file.name >> file.entries >> file.size >> file.modified;
+			files.push_back(file);
+		}
+		else if(type == "cluster" && !files.empty())
+		{
+			IndexedCluster cluster;
+			fields >> cluster.first_entry >> cluster.end_entry;
+			cluster.ranges.resize(branches.size());
+			for(size_t b = 0; b < branches.size(); b++)
+			{
+				fields >> cluster.ranges[b].minimum >> cluster.ranges[b].maximum;
+			}
+			files.back().clusters.push_back(cluster);
+		}
+		else
+		{
+			//Unknown content, so don't trust any of it
+			return false;
+		}
+		if(fields.fail())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool cluster_index_matches(TChain *chain, const vector<IndexedFile> &files)
+{
+	//The index has to describe exactly the trees of the
+	//chain, in the same order, and they can't have been
+	//rewritten since
+	if((Int_t)files.size() != chain->GetNtrees())
+	{
+		return false;
+	}
+	TObjArray *elements = chain->GetListOfFiles();
+	Long64_t *offsets = chain->GetTreeOffset();
+	for(size_t t = 0; t < files.size(); t++)
+	{
+		Long64_t size;
+		Long_t modified;
+		get_file_identity(elements->At(t)->GetTitle(), size, modified);
+		if(files[t].name != elements->At(t)->GetTitle()
+		   || files[t].entries != offsets[t + 1] - offsets[t]
+		   || files[t].size != size || files[t].modified != modified)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+bool load_cluster_index_from_options(po::variables_map options, TChain *chain, ClusterIndex &index)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	index.skipped.clear();
+	index.skipped_entries = 0;
+	if(options.count("cluster-index") == 0)
+	{
+		return true;
+	}
+	string path = options["cluster-index"].as<string>();
+
+	//Read the index, or build it if it doesn't exist or is
+	//out of date (and we know what to index)
+	vector<string> branches;
+	vector<IndexedFile> files;
+	bool loaded = (read_cluster_index(path, branches, files)
+				   && cluster_index_matches(chain, files));
+	if(options.count("index-branches") > 0)
+	{
+		vector<string> requested = options["index-branches"].as< vector<string> >();
+		loaded = loaded && (requested == branches);
+		branches = requested;
+	}
+	if(!loaded)
+	{
+		if(options.count("index-branches") == 0)
+		{
+			cerr << "ERROR: The cluster index (" << path << ") is missing or doesn't match the input,"
+				 << " and no --index-branches were given to rebuild it." << endl;
+			return false;
+		}
+		if(verbose)
+		{
+			cout << "Building cluster index " << path << endl;
+		}
+		if(!build_cluster_index(chain, branches, files)
+		   || !write_cluster_index(path, branches, files))
+		{
+			return false;
+		}
+	}
+
+	//A cutflow has to see every entry
+	if(options.count("cutflow") > 0 || options.count("cutflow-weight") > 0)
+	{
+		if(verbose)
+		{
+			cout << "Not skipping clusters, since a cutflow was requested" << endl;
+		}
+		return true;
+	}
+
+	//Find the cuts which the index can check
+	vector<RangeCut> range_cuts;
+	get_range_cuts_from_options(options, range_cuts);
+	vector< pair<size_t, RangeCut> > indexed_cuts;
+	vector<RangeCut>::iterator range_cut;
+	for(range_cut = range_cuts.begin();
+		range_cut != range_cuts.end();
+		range_cut++)
+	{
+		vector<string>::iterator branch = find(branches.begin(), branches.end(), range_cut->branch);
+		if(branch != branches.end())
+		{
+			indexed_cuts.push_back(make_pair((size_t)(branch - branches.begin()), *range_cut));
+		}
+	}
+
+	//Collect the clusters which can't pass, merging
+	//neighbours
+	Long64_t *offsets = chain->GetTreeOffset();
+	for(size_t t = 0; t < files.size(); t++)
+	{
+		vector<IndexedCluster>::iterator cluster;
+		for(cluster = files[t].clusters.begin();
+			cluster != files[t].clusters.end();
+			cluster++)
+		{
+			bool can_pass = true;
+			for(size_t c = 0; c < indexed_cuts.size() && can_pass; c++)
+			{
+				can_pass = range_can_pass(cluster->ranges[indexed_cuts[c].first], indexed_cuts[c].second);
+			}
+			if(can_pass)
+			{
+				continue;
+			}
+			Long64_t first_entry = offsets[t] + cluster->first_entry;
+			Long64_t end_entry = offsets[t] + cluster->end_entry;
+			if(!index.skipped.empty() && index.skipped.back().second == first_entry)
+			{
+				index.skipped.back().second = end_entry;
+			}
+			else
+			{
+				index.skipped.push_back(make_pair(first_entry, end_entry));
+			}
+			index.skipped_entries += end_entry - first_entry;
+		}
+	}
+	if(verbose)
+	{
+		cout << "Cluster index skips " << index.skipped_entries << " entries" << endl;
+	}
+
+	return true;
+}
+
+string get_selection_cache_path(po::variables_map options,
+								TChain *chain,
+								const string &selection,
+								Long64_t first_entry,
+								Long64_t end_entry)
+{
+	//Determine operating parameters
+	string cache_dir = options["selection-cache"].as<string>();
+	string container = options["container"].as<string>();
+
+	//Describe everything the selected entries depend on: the
+	//selection (ignoring whitespace), which entries were
+	//considered, and each input file, identified by its
+	//name, entry count and (where it can be found) size and
+	//modification time
+	ostringstream key;
+	string expression = selection;
+	expression.erase(remove_if(expression.begin(), expression.end(), ::isspace), expression.end());
+	key << "selection " << expression << endl;
+	key << "container " << container << endl;
+	key << "entries " << first_entry << " " << end_entry << endl;
+	TObjArray *elements = chain->GetListOfFiles();
+	Long64_t *offsets = chain->GetTreeOffset();
+	for(Int_t t = 0; t < chain->GetNtrees(); t++)
+	{
+		const char *name = elements->At(t)->GetTitle();
+		key << "file " << name << " " << offsets[t + 1] - offsets[t];
+		FileStat_t file_stat;
+		if(gSystem->GetPathInfo(name, file_stat) == 0)
+		{
+			key << " " << file_stat.fSize << " " << file_stat.fMtime;
+		}
+		key << endl;
+	}
+	TMD5 md5;
+	md5.Update((const UChar_t *)key.str().c_str(), key.str().length());
+	md5.Final();
+
+	return cache_dir + "/" + md5.AsString() + ".root";
+}
+
+bool load_selection_cache(string path, vector<Long64_t> &selected_entries)
+{
+	//A missing entry just means the selection hasn't been
+	//cached yet
+	if(gSystem->AccessPathName(path.c_str()))
+	{
+		return false;
+	}
+	TFile *file = TFile::Open(path.c_str());
+	if(file == NULL)
+	{
+		return false;
+	}
+	TEntryList *entry_list = dynamic_cast<TEntryList *>(file->Get("selected"));
+	bool loaded = (entry_list != NULL);
+	if(loaded)
+	{
+		selected_entries.clear();
+		selected_entries.reserve(entry_list->GetN());
+		for(Long64_t i = 0; i < entry_list->GetN(); i++)
+		{
+			selected_entries.push_back(entry_list->GetEntry(i));
+		}
+	}
+	file->Close();
+	delete file;
+
+	return loaded;
+}
+
+bool save_selection_cache(string path, const vector<Long64_t> &selected_entries)
+{
+	//Write to a temporary file and move it into place, so
+	//that concurrent runs never see a partial entry
+	gSystem->mkdir(gSystem->GetDirName(path.c_str()).Data(), kTRUE);
+	ostringstream temporary_path;
+	temporary_path << path << "." << gSystem->GetPid() << ".tmp";
+	TFile *file = TFile::Open(temporary_path.str().c_str(), "RECREATE");
+	if(file == NULL)
+	{
+		return false;
+	}
+	TEntryList entry_list("selected", "Selected entries");
+	vector<Long64_t>::const_iterator entry;
+	for(entry = selected_entries.begin();
+		entry != selected_entries.end();
+		entry++)
+	{
+		entry_list.Enter(*entry);
+	}
+	file->cd();
+	entry_list.Write();
+	file->Close();
+	delete file;
+
+	return gSystem->Rename(temporary_path.str().c_str(), path.c_str()) == 0;
+}
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef PHYSICSTOOLS_SKIMMER_INDEX_H
+#define PHYSICSTOOLS_SKIMMER_INDEX_H
+
+//Standard includes
+#include <string>
+#include <vector>
+#include <utility>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TChain.h>
+
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//Ranges of chain entries (whole clusters) which the
+//cluster index shows can't pass the selection, in order
+struct ClusterIndex
+{
+	std::vector< std::pair<Long64_t, Long64_t> > skipped;
+	Long64_t skipped_entries;
+};
+
+//Load (building it first if needed) the cluster index given
+//by the options, and find the clusters it rules out
+bool load_cluster_index_from_options(boost::program_options::variables_map options, TChain *chain, ClusterIndex &index);
+
+inline Long64_t skip_clusters(const ClusterIndex *index, size_t &cursor, Long64_t entry)
+{
+	//Return the first entry at or after this one which
+	//isn't in a skipped cluster
+	if(index == NULL)
+	{
+		return entry;
+	}
+	while(cursor < index->skipped.size() && index->skipped[cursor].second <= entry)
+	{
+		cursor++;
+	}
+	if(cursor < index->skipped.size() && index->skipped[cursor].first <= entry)
+	{
+		return index->skipped[cursor].second;
+	}
+	return entry;
+}
+
+
+//The path in the selection cache of the entries selected
+//from a range of a chain
+std::string get_selection_cache_path(boost::program_options::variables_map options,
+									 TChain *chain,
+									 const std::string &selection,
+									 Long64_t first_entry,
+									 Long64_t end_entry);
+
+//Read or write the entries stored in the selection cache
+bool load_selection_cache(std::string path, std::vector<Long64_t> &selected_entries);
+bool save_selection_cache(std::string path, const std::vector<Long64_t> &selected_entries);
+
+}
+
+}
+
+#endif
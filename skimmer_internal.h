@@ -0,0 +1,109 @@
+#ifndef PHYSICSTOOLS_SKIMMER_INTERNAL_H
+#define PHYSICSTOOLS_SKIMMER_INTERNAL_H
+
+//Standard includes
+#include <string>
+#include <vector>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TObject.h>
+#include <TChain.h>
+#include <TTreeFormula.h>
+
+//PhysicsTools includes
+#include "skimmer.h"
+
+//What the skimmer's sources share, which isn't part of
+//the skim interface
+namespace PhysicsTools
+{
+
+namespace Internal
+{
+
+//A selection compiled to native code
+class CompiledSelection;
+
+//The range of values a branch takes within one input
+//file, as recorded in an input list
+struct BranchRange
+{
+	double minimum;
+	double maximum;
+};
+
+//A cut of the form BRANCH OP VALUE, which can be checked
+//against the range of a branch
+struct RangeCut
+{
+	std::string branch;
+	std::string comparison;
+	double value;
+};
+
+//A derived quantity, computed for each selected entry
+//and written to the outputs as a new branch
+struct Define
+{
+	std::string name;
+	std::string expression;
+	TTreeFormula *formula;
+	CompiledSelection *compiled;
+	Double_t value;
+};
+
+//Forwards tree changes in the input chain to all of the
+//selections (formulas or compiled) which read from it
+class ChainNotifier : public TObject
+{
+	public:
+		void Add(TObject *object)
+		{
+			objects.push_back(object);
+		}
+
+		Bool_t Notify()
+		{
+			std::vector<TObject *>::iterator object;
+			for(object = objects.begin();
+				object != objects.end();
+				object++)
+			{
+				(*object)->Notify();
+			}
+			return kTRUE;
+		}
+
+	private:
+		std::vector<TObject *> objects;
+};
+
+//Whether a name can be used as a C++ identifier
+bool is_identifier(const std::string &name);
+
+//Whether any value in a range can pass a cut
+bool range_can_pass(const BranchRange &range, const RangeCut &cut);
+
+//Find the cuts which every selected entry must pass and
+//which can be checked against the range of a branch
+void get_range_cuts_from_options(boost::program_options::variables_map options, std::vector<RangeCut> &range_cuts);
+
+//Add the input files given by the options to a chain
+bool add_inputs_from_options(boost::program_options::variables_map options, TChain *chain);
+
+//Whether the container in the first input is an RNTuple
+//rather than a tree
+bool is_rntuple_input(boost::program_options::variables_map options);
+
+//The skim itself, which leaves the error level and restoring
+//process settings to the caller
+int skim(boost::program_options::variables_map options, TChain *input_chain);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,483 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <sstream>
+#include <algorithm>
+
+//Boost includes
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/asio.hpp>
+
+//ROOT includes
+#include <TROOT.h>
+#include <TError.h>
+#include <TChain.h>
+
+//PhysicsTools includes
+#include "skimmer.h"
+#include "skimmer_internal.h"
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespaces
+using namespace boost;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//The skim interface
+using namespace PhysicsTools;
+
+//The internals shared between the skimmer's sources
+using namespace PhysicsTools::Internal;
+
+namespace
+{
+
+//A skim request received by the server, with the
+//connection its result is reported on
+struct SkimJob
+{
+	boost::shared_ptr<boost::asio::ip::tcp::socket> socket;
+	po::variables_map options;
+};
+
+//An input chain kept by the server between skims, so
+//that its files needn't be opened again to count entries
+struct PooledChain
+{
+	TChain *chain;
+	bool busy;
+};
+
+//The state shared by the server's threads
+struct SkimServer
+{
+	boost::mutex mutex;
+	boost::condition_variable pending;
+	deque<SkimJob> jobs;
+	size_t max_queued;
+	bool stopping;
+	map<string, PooledChain> chains;
+	boost::asio::ip::tcp::acceptor *acceptor;
+	int request_timeout;
+	bool concurrent;
+	bool verbose;
+};
+
+//A connection whose request is being read.  Everything is
+//shared, since it is passed between the handlers of the
+//asynchronous operations on it.
+struct SkimConnection
+{
+	boost::shared_ptr<boost::asio::ip::tcp::socket> socket;
+	boost::shared_ptr<boost::asio::streambuf> buffer;
+	boost::shared_ptr<boost::asio::steady_timer> deadline;
+};
+
+void send_reply(boost::asio::ip::tcp::socket &socket, string reply)
+{
+	//The client may have gone away, which isn't our problem
+	boost::system::error_code error;
+	boost::asio::write(socket, boost::asio::buffer(reply + "\n"), error);
+}
+
+bool parse_skim_request(string request, po::variables_map &options, string &error)
+{
+	//A request is a line of skimslim command line options,
+	//quoted as for the shell
+	try
+	{
+		vector<string> arguments = po::split_unix(request);
+		po::store(po::command_line_parser(arguments).options(get_skim_options()).run(), options);
+		po::notify(options);
+	}
+	catch(std::exception& e)
+	{
+		error = e.what();
+		return false;
+	}
+	if(options.count("serve") > 0 || options.count("help") > 0)
+	{
+		error = "--serve and --help can't be requested from the server";
+		return false;
+	}
+	return true;
+}
+
+bool check_served_request(po::variables_map options, string &error)
+{
+	//Whoever can connect can run a skim as the server's
+	//user.  RDataFrame compiles the selection and definitions
+	//as C++, so that would let them run any code.
+	if(options["output-format"].as<string>() == "rntuple" || is_rntuple_input(options))
+	{
+		error = "RNTuple input and output compile the selection as C++, so aren't served";
+		return false;
+	}
+	return true;
+}
+
+bool check_concurrent_request(po::variables_map options, string &error)
+{
+	//Skims which run at the same time share the process, so
+	//none of them may change its settings.  The RDataFrame
+	//path uses implicit multithreading for its threads.
+	if(options.count("prefetch") > 0 || options.count("prefetch-cache-dir") > 0)
+	{
+		error = "--prefetch changes process settings, so needs --serve-jobs 1";
+		return false;
+	}
+	if(options.count("output-threads") > 0)
+	{
+		error = "--output-threads changes process settings, so needs --serve-jobs 1";
+		return false;
+	}
+	if(options.count("threads") > 0 && options["threads"].as<int>() > 1
+	   && (options["output-format"].as<string>() == "rntuple" || is_rntuple_input(options)))
+	{
+		error = "--threads with RNTuple changes process settings, so needs --serve-jobs 1";
+		return false;
+	}
+	return true;
+}
+
+TChain * borrow_chain(SkimServer &server, po::variables_map options, bool &pooled)
+{
+	//Only chains of trees given by --input are kept.  An
+	//input list is filtered by the selection, and RNTuple
+	//isn't read through a chain.
+	pooled = false;
+	if(options.count("input") == 0 || options.count("container") == 0
+	   || options["output-format"].as<string>() != "ttree")
+	{
+		return NULL;
+	}
+	string container = options["container"].as<string>();
+	string key = container + "\n" + options["input"].as<string>();
+	{
+		boost::mutex::scoped_lock lock(server.mutex);
+		map<string, PooledChain>::iterator pooled_chain = server.chains.find(key);
+		if(pooled_chain != server.chains.end())
+		{
+			//A chain in use by another skim can't be shared,
+			//so that skim gets its own
+			if(pooled_chain->second.busy)
+			{
+				return NULL;
+			}
+			pooled_chain->second.busy = true;
+			pooled = true;
+			return pooled_chain->second.chain;
+		}
+	}
+
+	//Open a new chain, outside the lock as this can be slow
+	if(is_rntuple_input(options))
+	{
+		return NULL;
+	}
+	TChain *chain = new TChain(container.c_str());
+	if(!add_inputs_from_options(options, chain))
+	{
+		//Let the skim report the error
+		delete chain;
+		return NULL;
+	}
+	chain->GetEntries();
+
+	//Keep it, unless another skim has just done the same
+	boost::mutex::scoped_lock lock(server.mutex);
+	if(server.chains.count(key) == 0)
+	{
+		PooledChain pooled_chain = {chain, true};
+		server.chains[key] = pooled_chain;
+		pooled = true;
+	}
+	return chain;
+}
+
+void return_chain(SkimServer &server, TChain *chain, bool pooled)
+{
+	if(!pooled)
+	{
+		delete chain;
+		return;
+	}
+	boost::mutex::scoped_lock lock(server.mutex);
+	map<string, PooledChain>::iterator pooled_chain;
+	for(pooled_chain = server.chains.begin();
+		pooled_chain != server.chains.end();
+		pooled_chain++)
+	{
+		if(pooled_chain->second.chain == chain)
+		{
+			pooled_chain->second.busy = false;
+		}
+	}
+}
+
+void run_skim_server_worker(SkimServer *server)
+{
+	while(true)
+	{
+		//Wait for the next job
+		SkimJob job;
+		{
+			boost::mutex::scoped_lock lock(server->mutex);
+			while(server->jobs.empty() && !server->stopping)
+			{
+				server->pending.wait(lock);
+			}
+			if(server->jobs.empty())
+			{
+				return;
+			}
+			job = server->jobs.front();
+			server->jobs.pop_front();
+		}
+		string error;
+		if(!check_served_request(job.options, error)
+		   || (server->concurrent && !check_concurrent_request(job.options, error)))
+		{
+			send_reply(*job.socket, "ERROR " + error);
+			continue;
+		}
+		send_reply(*job.socket, "RUNNING");
+
+		//Run it on a warm chain, if there is one.  A single
+		//job may change the process settings, which are
+		//restored after it, but concurrent jobs leave them as
+		//the server set them.
+		bool pooled = false;
+		TChain *chain = borrow_chain(*server, job.options, pooled);
+		int status = server->concurrent ? skim(job.options, chain) : run_skim(job.options, chain);
+		if(chain != NULL)
+		{
+			return_chain(*server, chain, pooled);
+		}
+
+		ostringstream reply;
+		if(status == 0)
+		{
+			reply << "OK";
+		}
+		else
+		{
+			reply << "FAILED " << status;
+		}
+		send_reply(*job.socket, reply.str());
+	}
+}
+
+void handle_request(SkimServer *server, SkimConnection connection, const boost::system::error_code &error)
+{
+	//Give up on connections which timed out or failed.
+	//Otherwise, moving the deadline to never stops it
+	//closing the connection if it has already expired.
+	connection.deadline->expires_at(boost::asio::steady_timer::time_point::max());
+	if(error && error != boost::asio::error::eof)
+	{
+		return;
+	}
+	istream lines(connection.buffer.get());
+	string request;
+	getline(lines, request);
+	trim(request);
+	boost::asio::ip::tcp::socket &socket = *connection.socket;
+	if(request == "QUIT")
+	{
+		//No more connections are accepted, and the server
+		//stops once those being read are done
+		send_reply(socket, "OK");
+		boost::system::error_code ignored;
+		server->acceptor->close(ignored);
+		return;
+	}
+
+	SkimJob job;
+	job.socket = connection.socket;
+	string parse_error;
+	if(!parse_skim_request(request, job.options, parse_error))
+	{
+		send_reply(socket, "ERROR " + parse_error);
+		return;
+	}
+	if(server->verbose)
+	{
+		cout << "Received skim: " << request << endl;
+	}
+
+	//Queue it, unless too many are waiting already
+	boost::mutex::scoped_lock lock(server->mutex);
+	if(server->jobs.size() >= server->max_queued)
+	{
+		send_reply(socket, "BUSY");
+		return;
+	}
+	server->jobs.push_back(job);
+	ostringstream reply;
+	reply << "QUEUED " << server->jobs.size();
+	send_reply(socket, reply.str());
+	server->pending.notify_one();
+}
+
+void handle_request_deadline(SkimConnection connection, const boost::system::error_code &error)
+{
+	//Closing the socket aborts the read of the request,
+	//unless the request has already been read
+	if(connection.deadline->expiry() > boost::asio::steady_timer::clock_type::now())
+	{
+		return;
+	}
+	boost::system::error_code ignored;
+	connection.socket->close(ignored);
+}
+
+SkimConnection create_connection(SkimServer *server)
+{
+	SkimConnection connection;
+	connection.socket.reset(new boost::asio::ip::tcp::socket(server->acceptor->get_executor()));
+	connection.buffer.reset(new boost::asio::streambuf());
+	connection.deadline.reset(new boost::asio::steady_timer(server->acceptor->get_executor()));
+	return connection;
+}
+
+void handle_accept(SkimServer *server, SkimConnection connection, const boost::system::error_code &error)
+{
+	//The acceptor is closed when the server is asked to
+	//stop
+	if(!server->acceptor->is_open())
+	{
+		return;
+	}
+	if(error)
+	{
+		cerr << "WARNING: Unable to accept a connection: " << error.message() << endl;
+	}
+	else
+	{
+		//Give the client a while to send its request
+		connection.deadline->expires_after(boost::asio::chrono::seconds(server->request_timeout));
+		connection.deadline->async_wait(boost::bind(handle_request_deadline,
+													connection,
+													boost::asio::placeholders::error));
+		boost::asio::async_read_until(*connection.socket, *connection.buffer, '\n',
+									  boost::bind(handle_request,
+												  server,
+												  connection,
+												  boost::asio::placeholders::error));
+	}
+
+	//Wait for the next connection
+	SkimConnection next = create_connection(server);
+	server->acceptor->async_accept(*next.socket,
+								   boost::bind(handle_accept,
+											   server,
+											   next,
+											   boost::asio::placeholders::error));
+}
+
+}
+
+namespace PhysicsTools
+{
+
+int run_skim_server(po::variables_map options)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	int port = options["serve"].as<int>();
+	string address = options["serve-address"].as<string>();
+	int n_jobs = options["serve-jobs"].as<int>();
+	int max_queued = options["serve-queue"].as<int>();
+	int request_timeout = options["serve-timeout"].as<int>();
+	if(n_jobs <= 0 || max_queued <= 0 || request_timeout <= 0)
+	{
+		cerr << "ERROR: Number of server jobs, queue length and request timeout must be > 0 to make sense" << endl;
+		return 1;
+	}
+	if(!verbose)
+	{
+		gErrorIgnoreLevel = kBreak;
+	}
+	if(n_jobs > 1)
+	{
+		ROOT::EnableThreadSafety();
+	}
+
+	//Listen for requests
+	boost::asio::io_context context;
+	boost::asio::ip::tcp::acceptor acceptor(context);
+	try
+	{
+		boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::make_address(address), port);
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+		acceptor.bind(endpoint);
+		acceptor.listen();
+	}
+	catch(std::exception& e)
+	{
+		cerr << "ERROR: Unable to listen on " << address << ":" << port << ": " << e.what() << endl;
+		return 1;
+	}
+	if(verbose)
+	{
+		cout << "Serving skims on " << address << ":" << port << " with " << n_jobs << " jobs" << endl;
+	}
+
+	//Start the workers
+	SkimServer server;
+	server.max_queued = max_queued;
+	server.stopping = false;
+	boost::thread_group workers;
+	for(int j = 0; j < n_jobs; j++)
+	{
+		workers.create_thread(boost::bind(run_skim_server_worker, &server));
+	}
+
+	//Each connection sends one request line, and is told
+	//when the skim is queued, running and finished.  A
+	//request of QUIT stops the server once the queued
+	//skims are done.  Requests are read asynchronously, so
+	//a slow client can't hold up any other.
+	server.acceptor = &acceptor;
+	server.request_timeout = request_timeout;
+	server.concurrent = (n_jobs > 1);
+	server.verbose = verbose;
+	SkimConnection first = create_connection(&server);
+	acceptor.async_accept(*first.socket,
+						  boost::bind(handle_accept,
+									  &server,
+									  first,
+									  boost::asio::placeholders::error));
+	context.run();
+
+	//Finish the queued skims and close the chains
+	{
+		boost::mutex::scoped_lock lock(server.mutex);
+		server.stopping = true;
+		server.pending.notify_all();
+	}
+	workers.join_all();
+	map<string, PooledChain>::iterator pooled_chain;
+	for(pooled_chain = server.chains.begin();
+		pooled_chain != server.chains.end();
+		pooled_chain++)
+	{
+		delete pooled_chain->second.chain;
+	}
+
+	return 0;
+}
+
+}
@@ -0,0 +1,741 @@
+//Standard includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+//Boost includes
+#include <boost/program_options.hpp>
+
+//ROOT includes
+#include <TROOT.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+#include <TSystem.h>
+
+//Standard namespaces
+using namespace std;
+
+//Boost namespaces
+using namespace boost;
+
+//Boost namespace aliases
+namespace po = boost::program_options;
+
+//Name of the tree in the generated ntuples
+const string BENCH_TREE_NAME = "bench";
+
+//Seed of the generator, so that every run reads the same
+//data
+const UInt_t BENCH_SEED = 4357;
+
+//Fraction of entries passing each of the many cuts
+const double MANY_CUTS_THRESHOLD = 0.9;
+
+//Fraction of the scalar branches kept when slimming
+const double WIDE_SLIM_FRACTION = 0.1;
+
+po::variables_map parse_command_line_options(int argc, char * argv[])
+{
+	//Create the options specifier
+	po::options_description desc("Allowed Options");
+	desc.add_options()
+		("verbose,v", "Make the program print more detailed output to command line.")
+		("skimslim", po::value<string>()->default_value("./skimslim"), "The skimslim executable to benchmark.")
+		("work-dir", po::value<string>()->default_value(string(gSystem->TempDirectory()) + "/skimslim_bench"),
+					 "Directory in which the synthetic ntuples and outputs are kept.  Ntuples"
+					 " are only generated if one with the same parameters isn't already there.")
+		("entries,n", po::value<Long64_t>()->default_value(100000), "Number of entries in the synthetic ntuple.")
+		("branches,b", po::value<int>()->default_value(100), "Number of scalar (Float_t) branches, x0, x1, ...,"
+															 " uniformly distributed in [0, 1).")
+		("arrays,a", po::value<int>()->default_value(10), "Number of variable length Float_t array branches, a0, a1, ...")
+		("array-size", po::value<int>()->default_value(10), "Maximum length of the arrays.  Each entry's length is"
+															" uniformly distributed up to it.")
+		("compression,z", po::value<int>()->default_value(101), "Numeric ROOT compression setting of the ntuple (e.g. 404).")
+		("scenario", po::value< vector<string> >()->multitoken(), "Scenario(s) to run (no-cut, no-fast-clone, cut-1pct,"
+																  " many-cuts, wide-slim).  All are run by default.")
+		("options", po::value<string>()->default_value(""), "Additional options passed to every skimslim run, so that"
+															" a feature can be compared against a run without it"
+															" (e.g. \"--prefetch --cache-size 50000000\").")
+		("remote-prefix", po::value<string>(), "Also run every scenario reading the ntuple through this URL prefix"
+											   " (e.g. root://host//data/ or http://host/), under which the"
+											   " work directory is served, to measure latency-bound reading.")
+		("repeat,r", po::value<int>()->default_value(3), "Number of times each scenario is run.  The best and mean"
+														 " times are reported.")
+		("report-json", po::value<string>(), "Also write the report to this path as JSON.")
+		("check", "Instead of timing scenarios, check that skims with --threads, --two-phase, --file-jobs,"
+				  " --compile-selection and --cluster-index select the same entries as a plain skim,"
+				  " failing if any of them differ.")
+		("help,h", "Print a description of the program options.")
+	;
+
+	//Do the actual parsing
+	po::variables_map vm;
+
+	try
+	{
+		po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+		po::notify(vm);
+
+		//Print help if necessary
+		if(vm.count("help"))
+		{
+			cout << desc << endl;
+			exit(1);
+		}
+	}
+	catch(std::exception& e)
+	{
+		cerr << "Couldn't parse command line options: " << e.what() << endl;
+		cout << desc << endl;
+		exit(1);
+	}
+	catch(...)
+	{
+		cerr << "Couldn't parse command line options, not sure why." << endl;
+		cout << desc << endl;
+		exit(1);
+	}
+
+	return vm;
+}
+
+string get_ntuple_path(po::variables_map options)
+{
+	//Name the ntuple by its parameters, so that it is only
+	//regenerated when they change
+	ostringstream path;
+	path << options["work-dir"].as<string>() << "/bench"
+		 << "_n" << options["entries"].as<Long64_t>()
+		 << "_b" << options["branches"].as<int>()
+		 << "_a" << options["arrays"].as<int>()
+		 << "x" << options["array-size"].as<int>()
+		 << "_z" << options["compression"].as<int>()
+		 << ".root";
+	return path.str();
+}
+
+bool generate_ntuple(po::variables_map options, string path)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	Long64_t entries = options["entries"].as<Long64_t>();
+	int n_branches = options["branches"].as<int>();
+	int n_arrays = options["arrays"].as<int>();
+	int array_size = options["array-size"].as<int>();
+	int compression = options["compression"].as<int>();
+	if(entries <= 0 || n_branches <= 0 || n_arrays < 0 || array_size <= 0)
+	{
+		cerr << "ERROR: The ntuple needs > 0 entries, scalar branches and array size, and >= 0 arrays" << endl;
+		return false;
+	}
+
+	if(verbose)
+	{
+		cout << "Generating " << path << endl;
+	}
+
+	//Write to a temporary file, so that an interrupted run
+	//doesn't leave a truncated ntuple to be reused
+	string temporary = path + ".tmp";
+	TFile *file = TFile::Open(temporary.c_str(), "RECREATE", "", compression);
+	if(file == NULL)
+	{
+		cerr << "ERROR: Unable to open the ntuple (" << temporary << ") for writing." << endl;
+		return false;
+	}
+	file->cd();
+	TTree *tree = new TTree(BENCH_TREE_NAME.c_str(), "Synthetic skimslim benchmark ntuple");
+
+	//Create the branches
+	Long64_t event = 0;
+	Int_t length = 0;
+	vector<Float_t> scalars(n_branches);
+	vector<Float_t> arrays((size_t)n_arrays * array_size + 1);
+	tree->Branch("event", &event, "event/L");
+	for(int b = 0; b < n_branches; b++)
+	{
+		ostringstream name;
+		name << "x" << b;
+		tree->Branch(name.str().c_str(), &scalars[b], (name.str() + "/F").c_str());
+	}
+	if(n_arrays > 0)
+	{
+		tree->Branch("n", &length, "n/I");
+	}
+	for(int a = 0; a < n_arrays; a++)
+	{
+		ostringstream name;
+		name << "a" << a;
+		tree->Branch(name.str().c_str(), &arrays[(size_t)a * array_size], (name.str() + "[n]/F").c_str());
+	}
+
+	//Fill them
+	TRandom3 random(BENCH_SEED);
+	for(event = 0; event < entries; event++)
+	{
+		for(int b = 0; b < n_branches; b++)
+		{
+			scalars[b] = random.Rndm();
+		}
+		length = random.Integer(array_size + 1);
+		for(int a = 0; a < n_arrays; a++)
+		{
+			for(int i = 0; i < length; i++)
+			{
+				arrays[(size_t)a * array_size + i] = random.Rndm();
+			}
+		}
+		tree->Fill();
+	}
+
+	//Save the file
+	file->Write();
+	file->Close();
+	delete file;
+	if(gSystem->Rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		cerr << "ERROR: Unable to move the ntuple into place (" << path << ")." << endl;
+		return false;
+	}
+
+	return true;
+}
+
+//A skim to time, given as the skimslim options which
+//define it
+struct Scenario
+{
+	string name;
+	string options;
+};
+
+void get_scenarios(po::variables_map options, vector<Scenario> &scenarios)
+{
+	//Determine operating parameters
+	int n_branches = options["branches"].as<int>();
+
+	//No selection, which is done by fast cloning
+	Scenario no_cut = {"no-cut", ""};
+	scenarios.push_back(no_cut);
+
+	//No selection, with every entry read and filled
+	Scenario no_fast_clone = {"no-fast-clone", "--no-fast-clone"};
+	scenarios.push_back(no_fast_clone);
+
+	//A single cut keeping 1% of the entries
+	Scenario cut_1pct = {"cut-1pct", "--selection \"x0 < 0.01\""};
+	scenarios.push_back(cut_1pct);
+
+	//Many cuts, each on a different branch
+	ostringstream many;
+	for(int b = 0; b < min(n_branches, 10); b++)
+	{
+		many << " --selection \"x" << b << " < " << MANY_CUTS_THRESHOLD << "\"";
+	}
+	Scenario many_cuts = {"many-cuts", many.str().substr(1)};
+	scenarios.push_back(many_cuts);
+
+	//A loose cut, keeping only a few of the branches
+	ostringstream slim;
+	slim << "--selection \"x0 < 0.5\" --disable-all-branches";
+	int kept = max((int)(n_branches * WIDE_SLIM_FRACTION), 1);
+	for(int b = 0; b < kept; b++)
+	{
+		slim << " --enable-branches x" << b;
+	}
+	Scenario wide_slim = {"wide-slim", slim.str()};
+	scenarios.push_back(wide_slim);
+
+	//Only keep the requested scenarios
+	if(options.count("scenario") > 0)
+	{
+		vector<string> requested = options["scenario"].as< vector<string> >();
+		vector<Scenario> selected;
+		vector<Scenario>::iterator scenario;
+		for(scenario = scenarios.begin();
+			scenario != scenarios.end();
+			scenario++)
+		{
+			if(find(requested.begin(), requested.end(), scenario->name) != requested.end())
+			{
+				selected.push_back(*scenario);
+			}
+		}
+		scenarios = selected;
+	}
+}
+
+//The timings of one scenario read from one location
+struct BenchResult
+{
+	string scenario;
+	string location;
+	string command;
+	int runs;
+	Double_t best_time;
+	Double_t mean_time;
+	Long64_t output_bytes;
+	bool success;
+};
+
+Long64_t get_file_size(string path)
+{
+	FileStat_t stat;
+	if(gSystem->GetPathInfo(path.c_str(), stat) != 0)
+	{
+		return -1;
+	}
+	return stat.fSize;
+}
+
+BenchResult run_scenario(po::variables_map options, const Scenario &scenario, string location, string input)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	int repeat = options["repeat"].as<int>();
+	string output = options["work-dir"].as<string>() + "/output_" + scenario.name + ".root";
+
+	//Build the command line
+	ostringstream command;
+	command << options["skimslim"].as<string>()
+			<< " --input \"" << input << "\""
+			<< " --container " << BENCH_TREE_NAME
+			<< " --output \"" << output << "\""
+			<< " --replace";
+	if(scenario.options.length() > 0)
+	{
+		command << " " << scenario.options;
+	}
+	if(options["options"].as<string>().length() > 0)
+	{
+		command << " " << options["options"].as<string>();
+	}
+	if(!verbose)
+	{
+		command << " > /dev/null";
+	}
+
+	BenchResult result;
+	result.scenario = scenario.name;
+	result.location = location;
+	result.command = command.str();
+	result.runs = 0;
+	result.best_time = 0;
+	result.mean_time = 0;
+	result.output_bytes = -1;
+	result.success = true;
+
+	//Time each run
+	for(int r = 0; r < repeat && result.success; r++)
+	{
+		if(verbose)
+		{
+			cout << "Running: " << result.command << endl;
+		}
+		TStopwatch timer;
+		timer.Start();
+		int status = gSystem->Exec(result.command.c_str());
+		timer.Stop();
+		if(status != 0)
+		{
+			cerr << "ERROR: Scenario " << scenario.name << " (" << location << ") failed with status "
+				 << status << endl;
+			result.success = false;
+			break;
+		}
+		Double_t time = timer.RealTime();
+		result.best_time = (result.runs == 0) ? time : min(result.best_time, time);
+		result.mean_time += time;
+		result.runs++;
+	}
+	if(result.runs > 0)
+	{
+		result.mean_time /= result.runs;
+	}
+	result.output_bytes = get_file_size(output);
+	gSystem->Unlink(output.c_str());
+
+	return result;
+}
+
+void print_report(po::variables_map options, Long64_t input_bytes, const vector<BenchResult> &results, ostream &out)
+{
+	//Describe the ntuple, so that reports can be compared
+	Long64_t entries = options["entries"].as<Long64_t>();
+	out << "skimslim benchmark" << endl;
+	out << "\tEntries: " << entries << endl;
+	out << "\tScalar branches: " << options["branches"].as<int>() << endl;
+	out << "\tArray branches: " << options["arrays"].as<int>()
+		<< " (up to " << options["array-size"].as<int>() << " elements)" << endl;
+	out << "\tCompression: " << options["compression"].as<int>() << endl;
+	out << "\tInput size (MB): " << input_bytes / 1e6 << endl;
+	out << "\tExtra options: " << options["options"].as<string>() << endl;
+	out << "\tRuns per scenario: " << options["repeat"].as<int>() << endl;
+
+	//One line per scenario
+	out << "Scenario\tLocation\tBest (s)\tMean (s)\tMB/s\tkHz\tOutput (MB)" << endl;
+	vector<BenchResult>::const_iterator result;
+	for(result = results.begin();
+		result != results.end();
+		result++)
+	{
+		out << result->scenario << "\t" << result->location << "\t";
+		if(!result->success || result->best_time <= 0)
+		{
+			out << "failed" << endl;
+			continue;
+		}
+		out << result->best_time << "\t" << result->mean_time << "\t"
+			<< input_bytes / 1e6 / result->best_time << "\t"
+			<< entries / 1e3 / result->best_time << "\t"
+			<< result->output_bytes / 1e6 << endl;
+	}
+}
+
+string json_escape(string value)
+{
+	string escaped;
+	for(string::iterator c = value.begin(); c != value.end(); c++)
+	{
+		if(*c == '"' || *c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += *c;
+	}
+	return escaped;
+}
+
+bool write_report_json(po::variables_map options,
+					   Long64_t input_bytes,
+					   const vector<BenchResult> &results,
+					   string path)
+{
+	ofstream out(path.c_str());
+	if(!out.is_open())
+	{
+		cerr << "ERROR: Unable to open the report (" << path << ") for writing." << endl;
+		return false;
+	}
+
+	out << "{" << endl;
+	out << "\t\"entries\": " << options["entries"].as<Long64_t>() << "," << endl;
+	out << "\t\"branches\": " << options["branches"].as<int>() << "," << endl;
+	out << "\t\"arrays\": " << options["arrays"].as<int>() << "," << endl;
+	out << "\t\"array_size\": " << options["array-size"].as<int>() << "," << endl;
+	out << "\t\"compression\": " << options["compression"].as<int>() << "," << endl;
+	out << "\t\"input_bytes\": " << input_bytes << "," << endl;
+	out << "\t\"options\": \"" << json_escape(options["options"].as<string>()) << "\"," << endl;
+	out << "\t\"results\": [" << endl;
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &result = results[i];
+		out << "\t\t{\"scenario\": \"" << result.scenario << "\""
+			<< ", \"location\": \"" << result.location << "\""
+			<< ", \"command\": \"" << json_escape(result.command) << "\""
+			<< ", \"success\": " << (result.success ? "true" : "false")
+			<< ", \"runs\": " << result.runs
+			<< ", \"best_time\": " << result.best_time
+			<< ", \"mean_time\": " << result.mean_time
+			<< ", \"output_bytes\": " << result.output_bytes << "}"
+			<< ((i + 1 < results.size()) ? "," : "") << endl;
+	}
+	out << "\t]" << endl;
+	out << "}" << endl;
+
+	return true;
+}
+
+//A skim mode compared against a plain skim by --check,
+//given as the skimslim options which select it
+struct CheckMode
+{
+	string name;
+	string options;
+};
+
+void get_check_modes(po::variables_map options, vector<CheckMode> &modes)
+{
+	//Determine operating parameters
+	string work_dir = options["work-dir"].as<string>();
+	string index = work_dir + "/check_index.txt";
+
+	//Each mode promises the same entries, in the same order,
+	//as a plain skim
+	CheckMode threads = {"threads", "--threads 2"};
+	modes.push_back(threads);
+	CheckMode two_phase = {"two-phase", "--two-phase"};
+	modes.push_back(two_phase);
+	CheckMode file_jobs = {"file-jobs", "--file-jobs 2"};
+	modes.push_back(file_jobs);
+	CheckMode compiled = {"compile-selection", "--compile-selection --compile-cache-dir \"" + work_dir + "/check_compiled\""};
+	modes.push_back(compiled);
+
+	//The first cluster index run builds the index, the second
+	//reads it back
+	gSystem->Unlink(index.c_str());
+	CheckMode build_index = {"cluster-index-build", "--cluster-index \"" + index + "\" --index-branches x0"};
+	modes.push_back(build_index);
+	CheckMode read_index = {"cluster-index-read", "--cluster-index \"" + index + "\""};
+	modes.push_back(read_index);
+}
+
+//The values of one output entry compared by --check
+struct CheckEntry
+{
+	Long64_t event;
+	Float_t x0;
+	Int_t n;
+};
+
+bool run_check_skim(po::variables_map options, string input_list, string mode_options, string output)
+{
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+
+	//Build the command line
+	ostringstream command;
+	command << options["skimslim"].as<string>()
+			<< " --input-list \"" << input_list << "\""
+			<< " --container " << BENCH_TREE_NAME
+			<< " --output \"" << output << "\""
+			<< " --replace"
+			<< " --selection \"x0 < 0.1\" --selection \"x1 < 0.5\"";
+	if(mode_options.length() > 0)
+	{
+		command << " " << mode_options;
+	}
+	if(options["options"].as<string>().length() > 0)
+	{
+		command << " " << options["options"].as<string>();
+	}
+	if(!verbose)
+	{
+		command << " > /dev/null";
+	}
+
+	if(verbose)
+	{
+		cout << "Running: " << command.str() << endl;
+	}
+	int status = gSystem->Exec(command.str().c_str());
+	if(status != 0)
+	{
+		cerr << "ERROR: skimslim failed with status " << status << " (" << command.str() << ")" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool read_check_entries(string path, vector<CheckEntry> &entries)
+{
+	entries.clear();
+	TFile *file = TFile::Open(path.c_str());
+	if(file == NULL || file->IsZombie())
+	{
+		cerr << "ERROR: Unable to open the output (" << path << ")." << endl;
+		delete file;
+		return false;
+	}
+	TTree *tree = dynamic_cast<TTree *>(file->Get(BENCH_TREE_NAME.c_str()));
+	if(tree == NULL)
+	{
+		cerr << "ERROR: The output (" << path << ") has no " << BENCH_TREE_NAME << " tree." << endl;
+		delete file;
+		return false;
+	}
+
+	//Arrays (and so their length) are optional
+	CheckEntry entry;
+	entry.n = 0;
+	tree->SetBranchAddress("event", &entry.event);
+	tree->SetBranchAddress("x0", &entry.x0);
+	if(tree->GetBranch("n") != NULL)
+	{
+		tree->SetBranchAddress("n", &entry.n);
+	}
+	for(Long64_t e = 0; e < tree->GetEntries(); e++)
+	{
+		if(tree->GetEntry(e) <= 0)
+		{
+			cerr << "ERROR: Unable to read entry " << e << " of the output (" << path << ")." << endl;
+			delete file;
+			return false;
+		}
+		entries.push_back(entry);
+	}
+	delete file;
+
+	return true;
+}
+
+bool same_check_entries(const vector<CheckEntry> &expected, const vector<CheckEntry> &entries, string name)
+{
+	if(entries.size() != expected.size())
+	{
+		cerr << "ERROR: " << name << " selected " << entries.size() << " entries, the plain skim "
+			 << expected.size() << endl;
+		return false;
+	}
+	for(size_t e = 0; e < entries.size(); e++)
+	{
+		if(entries[e].event != expected[e].event
+		   || entries[e].x0 != expected[e].x0
+		   || entries[e].n != expected[e].n)
+		{
+			cerr << "ERROR: " << name << " differs from the plain skim at output entry " << e << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int run_check(po::variables_map options, string ntuple)
+{
+	//Determine operating parameters
+	string work_dir = options["work-dir"].as<string>();
+
+	//Skim the ntuple and a copy of it, so that there is more
+	//than one file for --file-jobs
+	string copy = work_dir + "/check_copy.root";
+	if(gSystem->CopyFile(ntuple.c_str(), copy.c_str(), kTRUE) != 0)
+	{
+		cerr << "ERROR: Unable to copy the ntuple (" << ntuple << ") to " << copy << endl;
+		return 1;
+	}
+	string input_list = work_dir + "/check_inputs.txt";
+	ofstream list(input_list.c_str());
+	list << ntuple << endl << copy << endl;
+	list.close();
+	if(!list)
+	{
+		cerr << "ERROR: Unable to write the input list (" << input_list << ")." << endl;
+		return 1;
+	}
+
+	//The plain skim everything is compared against
+	string output = work_dir + "/check_output.root";
+	vector<CheckEntry> expected;
+	if(!run_check_skim(options, input_list, "", output) || !read_check_entries(output, expected))
+	{
+		return 1;
+	}
+	if(expected.empty())
+	{
+		cerr << "ERROR: The plain skim selected no entries, so there is nothing to compare" << endl;
+		return 1;
+	}
+
+	//Each mode must select the same entries
+	vector<CheckMode> modes;
+	get_check_modes(options, modes);
+	int failures = 0;
+	vector<CheckMode>::iterator mode;
+	for(mode = modes.begin();
+		mode != modes.end();
+		mode++)
+	{
+		vector<CheckEntry> entries;
+		bool same = (run_check_skim(options, input_list, mode->options, output)
+					 && read_check_entries(output, entries)
+					 && same_check_entries(expected, entries, mode->name));
+		cout << mode->name << "\t" << (same ? "same" : "DIFFERENT") << endl;
+		if(!same)
+		{
+			failures++;
+		}
+	}
+	gSystem->Unlink(output.c_str());
+	gSystem->Unlink(copy.c_str());
+
+	cout << "Checked " << modes.size() << " modes against " << expected.size() << " selected entries, "
+		 << failures << " differ" << endl;
+	return (failures == 0) ? 0 : 1;
+}
+
+int main(int argc, char * argv[])
+{
+	//Parse command line options.  This will do all error detection.
+	po::variables_map options = parse_command_line_options(argc, argv);
+
+	//Determine operating parameters
+	bool verbose = (options.count("verbose") > 0);
+	string work_dir = options["work-dir"].as<string>();
+	if(options["repeat"].as<int>() <= 0)
+	{
+		cerr << "ERROR: Number of runs must be > 0 to make sense" << endl;
+		return 1;
+	}
+	if(!verbose)
+	{
+		gErrorIgnoreLevel = kBreak;
+	}
+
+	//Generate the ntuple, if it isn't there already
+	if(gSystem->AccessPathName(work_dir.c_str()) && gSystem->mkdir(work_dir.c_str(), kTRUE) != 0)
+	{
+		cerr << "ERROR: Unable to create the work directory (" << work_dir << ")." << endl;
+		return 1;
+	}
+	string ntuple = get_ntuple_path(options);
+	if(gSystem->AccessPathName(ntuple.c_str()) && !generate_ntuple(options, ntuple))
+	{
+		return 1;
+	}
+	if(options.count("check") > 0)
+	{
+		return run_check(options, ntuple);
+	}
+	Long64_t input_bytes = get_file_size(ntuple);
+
+	//Run each scenario, locally and then remotely
+	vector<Scenario> scenarios;
+	get_scenarios(options, scenarios);
+	if(scenarios.empty())
+	{
+		cerr << "ERROR: None of the requested scenarios exist" << endl;
+		return 1;
+	}
+	vector<BenchResult> results;
+	vector<Scenario>::iterator scenario;
+	for(scenario = scenarios.begin();
+		scenario != scenarios.end();
+		scenario++)
+	{
+		results.push_back(run_scenario(options, *scenario, "local", ntuple));
+	}
+	if(options.count("remote-prefix") > 0)
+	{
+		string remote = options["remote-prefix"].as<string>() + gSystem->BaseName(ntuple.c_str());
+		for(scenario = scenarios.begin();
+			scenario != scenarios.end();
+			scenario++)
+		{
+			results.push_back(run_scenario(options, *scenario, "remote", remote));
+		}
+	}
+
+	//Report the results
+	print_report(options, input_bytes, results, cout);
+	bool success = true;
+	if(options.count("report-json") > 0)
+	{
+		success = write_report_json(options, input_bytes, results, options["report-json"].as<string>());
+	}
+	vector<BenchResult>::iterator result;
+	for(result = results.begin();
+		result != results.end();
+		result++)
+	{
+		success = success && result->success;
+	}
+
+	return success ? 0 : 1;
+}